@@ -0,0 +1,37 @@
+#ifndef COMPRESSEDGRAPHFORMAT_H
+#define COMPRESSEDGRAPHFORMAT_H
+
+#include <cstdint>
+
+// Block-compressed container of a BPCSR-file. Each graph is compressed on its own, hence the blocks
+// can be decompressed concurrently (and independently of each other).
+//
+// File:   [CompressedFileHeader][Block 0][Block 1]...[CompressedBlockEntry per graph]
+// Block:  zlib stream of the encoded graph. The encoded graph has the layout of its BPCSR-record, except
+//         for the numeric columns NO, ED, PO, IP, MW and PDB. Each of these is stored as zigzag varints of
+//         the differences to the previous value of the column (e.g. the -1 padding of PDB costs one byte).
+//
+// All fields of the header and of the block table are little endian.
+
+#define CPCSR_MAGIC "CPCSR\0\0"
+#define CPCSR_VERSION 1
+
+
+struct CompressedFileHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t reserved;
+    std::uint64_t num_graphs;
+    std::uint64_t table_offset;  // Offset of the block table (one CompressedBlockEntry per graph)
+};
+
+
+struct CompressedBlockEntry {
+    std::uint64_t offset;  // Beginning of the block in the file
+    std::uint64_t size;  // Compressed size of the block
+    std::uint64_t encoded_size;  // Size of the encoded graph (decompressed block)
+    std::uint64_t record_size;  // Size of the decoded graph (its BPCSR-record)
+};
+
+
+#endif
@@ -0,0 +1,25 @@
+#include <cstdio>
+#include <iostream>
+#include <string>
+
+#include "graph_loader.hpp"
+
+
+// One-time converter: BPCSR (big endian, parsed on every start) --> MPCSR (native, mmapped on start)
+// or CPCSR (block-compressed, decompressed concurrently on start), depending on the extension of the output
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        std::cerr << "Usage: " << argv[0] << " <input.bpcsr> <output.mpcsr|output.cpcsr>" << std::endl;
+        return 1;
+    }
+
+    std::cout << "Converting " << argv[1] << " to " << argv[2] << std::endl;
+    std::string output = argv[2];
+    if (output.size() >= 6 && output.compare(output.size() - 6, 6, ".cpcsr") == 0) {
+        GraphLoaderCompressed::convert(argv[1], argv[2]);
+    } else {
+        GraphLoaderMapped::convert(argv[1], argv[2]);
+    }
+
+    return 0;
+}
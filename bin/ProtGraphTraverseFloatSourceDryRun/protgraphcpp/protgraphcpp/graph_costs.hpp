@@ -0,0 +1,80 @@
+#ifndef GRAPHCOSTS_H
+#define GRAPHCOSTS_H
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <numeric>
+#include <vector>
+
+
+// Costs of the graphs of a query, by which its tasks are dispatched: the most expensive graphs first (longest
+// processing time first), so that a few giant proteins do not end up in the tail of every query. A graph is first
+// ranked by its estimated cost (e.g. ProteinGraph::estimated_cost) and, once it was traversed, by its measured
+// runtime (averaged over the queries). Estimates are converted to seconds by the ratio of the measured graphs.
+class GraphCosts {
+    public:
+        // Of num_graphs graphs, the estimates are given per graph to order
+        GraphCosts(std::size_t num_graphs, const std::vector<std::size_t>& graphs, const std::vector<double>& estimates) : graphs(graphs), estimates(estimates), runtimes(new std::atomic<double>[num_graphs]), keys(graphs.size()) {
+            for (std::size_t i = 0; i < num_graphs; i++) {
+                this->runtimes[i].store(0, std::memory_order_relaxed);
+            }
+        };
+
+        // Records a runtime of a graph (thread-safe, concurrent measurements of a graph may overwrite each other)
+        void measured(std::size_t graph, double seconds) {
+            double previous = this->runtimes[graph].load(std::memory_order_relaxed);
+            this->runtimes[graph].store((previous == 0) ? seconds : (previous + seconds) / 2, std::memory_order_relaxed);
+        };
+
+        // The graphs, most expensive first (ties in their order)
+        const std::vector<std::size_t>& order() {
+            double measured_sum = 0, estimated_sum = 0;
+            for (std::size_t k = 0; k < this->graphs.size(); k++) {
+                this->keys[k] = this->runtimes[this->graphs[k]].load(std::memory_order_relaxed);
+                if (this->keys[k] != 0) {
+                    measured_sum += this->keys[k];
+                    estimated_sum += this->estimates[k];
+                }
+            }
+            double seconds_per_cost = (estimated_sum != 0) ? measured_sum / estimated_sum : 1;
+            this->total = 0;
+            for (std::size_t k = 0; k < this->graphs.size(); k++) {
+                if (this->keys[k] == 0) { this->keys[k] = this->estimates[k] * seconds_per_cost; }
+                this->total += this->keys[k];
+            }
+
+            this->ranking.resize(this->graphs.size());
+            std::iota(this->ranking.begin(), this->ranking.end(), 0);
+            std::stable_sort(this->ranking.begin(), this->ranking.end(), [this](std::size_t a, std::size_t b) { return this->keys[a] > this->keys[b]; });
+            this->ordered.resize(this->graphs.size());
+            for (std::size_t k = 0; k < this->ranking.size(); k++) {
+                this->ordered[k] = this->graphs[this->ranking[k]];
+            }
+            return this->ordered;
+        };
+
+        // Number of parts (tasks) to split the traversal of the k-th graph of the last order into: a graph costing
+        // more than an even share of the query (which would be left alone in its tail) gets a part per share
+        std::uint32_t parts(std::size_t k, std::size_t num_threads) const {
+            if (this->total <= 0 || num_threads <= 1) {return 1;}
+            double shares = std::ceil(this->keys[this->ranking[k]] * num_threads / this->total);
+            return (std::uint32_t) std::clamp(shares, 1.0, (double) num_threads);
+        };
+
+    private:
+        std::vector<std::size_t> graphs;  // Graphs to order (ascending)
+        std::vector<double> estimates;  // Per graph to order
+        std::unique_ptr<std::atomic<double>[]> runtimes;  // Per graph of the graph set, in seconds (0 --> not measured yet)
+
+        std::vector<double> keys;  // Reused by order
+        double total = 0;  // Of the keys
+        std::vector<std::size_t> ranking;
+        std::vector<std::size_t> ordered;
+};
+
+
+#endif
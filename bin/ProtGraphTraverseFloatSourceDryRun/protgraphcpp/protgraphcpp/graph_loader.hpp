@@ -1,23 +1,100 @@
 #ifndef GRAPHLOADER_H
 #define GRAPHLOADER_H
 
+#include <cstdint>
+#include <optional>
 #include <string>
 
 #include "protein_graph.hpp"
+#include <unordered_set>
+#include <vector>
+
+
+// Entry of the index (sidecar "<file>.idx") of a BPCSR-file
+struct GraphIndexEntry {
+    std::string accession;  // First accession of the graph
+    std::uint64_t offset;  // Beginning of the graph in the file
+    std::uint64_t size;  // Number of bytes of the graph in the file
+};
 
 
 class GraphLoader{
     public:
         virtual ~GraphLoader() = default;
         virtual std::vector<ProteinGraph>* loadGraphs(std::string fileLoc) = 0;
+
+        // Restricts the graphs to load by their (first) accession: only the listed ones (allow-list) or all but
+        // the listed ones (deny-list). The other graphs are skipped without being built.
+        void filterAccessions(std::unordered_set<std::string> accessions, bool deny = false) {
+            this->accession_filter = std::move(accessions);
+            this->deny_listed = deny;
+        };
+        bool acceptsAccession(const std::string& accession) const {
+            return !this->accession_filter || (this->accession_filter->count(accession) != 0) != this->deny_listed;
+        };
+        // Entries of the index, whose graphs are accepted
+        std::vector<GraphIndexEntry> filterIndex(std::vector<GraphIndexEntry> index) const {
+            if (this->accession_filter) {
+                std::erase_if(index, [this](const GraphIndexEntry& entry) { return !this->acceptsAccession(entry.accession); });
+            }
+            return index;
+        };
+
+    protected:
+        std::optional<std::unordered_set<std::string>> accession_filter;  // Not set --> all graphs are loaded
+        bool deny_listed = false;
 };
 
 
 class GraphLoaderBinary: public GraphLoader {
     public:
+        GraphLoaderBinary(uint32_t num_threads = 1, std::uint32_t columns = COLUMNS_ALL) : num_threads(num_threads), columns(columns) {};
         ~GraphLoaderBinary() = default;
         
         std::vector<ProteinGraph>* loadGraphs(std::string fileLoc);
+
+        // Returns the index of the BPCSR-file, read from its sidecar if up to date (else it is rebuilt and written)
+        static std::vector<GraphIndexEntry> loadIndex(std::string fileLoc);
+        // Finds the beginning of each graph in the BPCSR-file (without parsing the graphs)
+        static std::vector<GraphIndexEntry> scanIndex(std::string fileLoc);
+        // Skips the remainder of a graph, after its number of accessions was read (as in the ProteinGraph). Returns its first accession
+        static std::string skipGraph(std::uint32_t num_acc, std::ifstream &input);
+
+    private:
+        uint32_t num_threads;  // Number of threads, which parse graphs concurrently
+        std::uint32_t columns;  // Requested columns (see protein_graph.hpp)
+};
+
+
+class GraphLoaderMapped: public GraphLoader {
+    public:
+        GraphLoaderMapped(std::uint32_t columns = COLUMNS_ALL) : columns(columns) {};
+        ~GraphLoaderMapped() = default;
+
+        std::vector<ProteinGraph>* loadGraphs(std::string fileLoc);
+
+        // One-time conversion of a BPCSR-file into the (mmappable) MPCSR-file
+        static void convert(std::string bpcsrLoc, std::string mpcsrLoc);
+
+    private:
+        std::uint32_t columns;  // Requested columns (see protein_graph.hpp)
+};
+
+
+// Loads a CPCSR-file (see compressed_graph_format.hpp), its blocks are decompressed and parsed concurrently
+class GraphLoaderCompressed: public GraphLoader {
+    public:
+        GraphLoaderCompressed(uint32_t num_threads = 1, std::uint32_t columns = COLUMNS_ALL) : num_threads(num_threads), columns(columns) {};
+        ~GraphLoaderCompressed() = default;
+
+        std::vector<ProteinGraph>* loadGraphs(std::string fileLoc);
+
+        // One-time conversion of a BPCSR-file into the (block-compressed) CPCSR-file
+        static void convert(std::string bpcsrLoc, std::string cpcsrLoc);
+
+    private:
+        uint32_t num_threads;  // Number of threads, which decompress and parse graphs concurrently
+        std::uint32_t columns;  // Requested columns (see protein_graph.hpp)
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,211 @@
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <fstream>
+#include <endian.h>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "graph_loader.hpp"
+#include "mapped_graph_format.hpp"
+#include "protein_graph.hpp"
+#include "string_pool.hpp"
+#include <unordered_map>
+#include <vector>
+
+
+std::vector<ProteinGraph>* GraphLoaderMapped::loadGraphs(std::string fileLoc) {
+
+    std::vector<ProteinGraph>* pgs = new std::vector<ProteinGraph>;  // Ptr to vector
+
+    // Map the whole file (read only). The ProteinGraphs point directly into it, hence they share the
+    // ownership of the mapping (it is unmapped with the last graph).
+    int fd = open(fileLoc.c_str(), O_RDONLY);
+    if (fd == -1) {
+        throw std::runtime_error("Could not open MPCSR-file: " + fileLoc);
+    }
+    struct stat file_stat;
+    fstat(fd, &file_stat);
+    if ((std::size_t) file_stat.st_size < sizeof(MappedFileHeader)) {
+        close(fd);
+        throw std::runtime_error("MPCSR-file is too small: " + fileLoc);
+    }
+    const char* mapping = (const char*) mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);  // The mapping keeps its own reference
+    if (mapping == MAP_FAILED) {
+        throw std::runtime_error("Could not mmap MPCSR-file: " + fileLoc);
+    }
+    std::size_t mapping_size = file_stat.st_size;
+    std::shared_ptr<const char> mapping_owner(mapping, [mapping_size](const char* ptr) { munmap((void*) ptr, mapping_size); });
+
+    // Check if the file can be used on this host and in this build
+    const MappedFileHeader* header = (const MappedFileHeader*) mapping;
+    if (std::memcmp(header->magic, MPCSR_MAGIC, sizeof(header->magic)) != 0) {
+        throw std::runtime_error("Not a MPCSR-file: " + fileLoc);
+    }
+    if (header->endian_check != MPCSR_ENDIAN_CHECK) {
+        throw std::runtime_error("MPCSR-file was generated on a host with a different endianness: " + fileLoc);
+    }
+    if (header->version != MPCSR_VERSION) {
+        throw std::runtime_error("MPCSR-file has version " + std::to_string(header->version) + ", expected " + std::to_string(MPCSR_VERSION) + ". Please reconvert: " + fileLoc);
+    }
+    if (header->value_type != MPCSR_VALUE_DOUBLE) {
+        throw std::runtime_error("MPCSR-file was converted for the Int-Version: " + fileLoc);
+    }
+
+    // The string pool points into the mapping (the ids are the positions in the string section), hence it shares
+    // the ownership of the mapping as well (pruned graphs do not point into the mapping anymore, but their strings do)
+    std::shared_ptr<StringPool> strings = std::make_shared<StringPool>();
+    strings->keep(mapping_owner);
+    const std::uint64_t* string_offsets = (const std::uint64_t*) (mapping + header->strings_offset);
+    const char* string_chars = mapping + header->strings_offset + header->num_strings * sizeof(std::uint64_t);
+    for (std::uint64_t i = 0; i < header->num_strings; i++) {
+        strings->adopt(string_chars + string_offsets[i]);
+    }
+
+    // Create the ProteinGraphs (only the accessions are copied)
+    const std::uint64_t* record_offsets = (const std::uint64_t*) (mapping + header->table_offset);
+    pgs->reserve(header->num_graphs);
+    for (std::uint64_t i = 0; i < header->num_graphs; i++) {
+        const char* record = mapping + record_offsets[i];
+        if (!this->acceptsAccession(record + ((const MappedGraphHeader*) record)->accessions)) continue;  // Its first accession
+        pgs->push_back(ProteinGraph(mapping + record_offsets[i], mapping_owner, strings, this->columns));
+    }
+
+    return pgs;
+};
+
+
+// Helpers for the conversion
+static std::uint64_t align_offset(std::uint64_t offset) {
+    return (offset + MPCSR_ALIGNMENT - 1) / MPCSR_ALIGNMENT * MPCSR_ALIGNMENT;
+}
+
+static void write_padding(std::ofstream& output, std::uint64_t& offset) {
+    static const char zeros[MPCSR_ALIGNMENT] = {0};
+    std::uint64_t aligned = align_offset(offset);
+    output.write(zeros, aligned - offset);
+    offset = aligned;
+}
+
+static std::uint64_t write_column(std::ofstream& output, std::uint64_t& offset, const void* data, std::uint64_t size) {
+    write_padding(output, offset);
+    std::uint64_t column_offset = offset;
+    output.write((const char*) data, size);
+    offset += size;
+    return column_offset;
+}
+
+
+void GraphLoaderMapped::convert(std::string bpcsrLoc, std::string mpcsrLoc) {
+    std::ifstream input(bpcsrLoc, std::ios::binary);
+    if (!input) {
+        throw std::runtime_error("Could not open BPCSR-file: " + bpcsrLoc);
+    }
+    std::ofstream output(mpcsrLoc, std::ios::binary | std::ios::trunc);
+    if (!output) {
+        throw std::runtime_error("Could not create MPCSR-file: " + mpcsrLoc);
+    }
+
+    // Placeholder header, it is rewritten at the end
+    MappedFileHeader header = {};
+    std::memcpy(header.magic, MPCSR_MAGIC, sizeof(header.magic));
+    header.version = MPCSR_VERSION;
+    header.endian_check = MPCSR_ENDIAN_CHECK;
+    header.value_type = MPCSR_VALUE_DOUBLE;
+    output.write((const char*) &header, sizeof(header));
+    std::uint64_t offset = sizeof(header);
+
+    std::vector<std::uint64_t> record_offsets;
+    std::shared_ptr<StringPool> strings = std::make_shared<StringPool>();  // Of all graphs, written at the end
+    uint32_t num_acc;
+
+    // Convert graph by graph (only one graph is kept in memory)
+    while (input.read((char*) &num_acc, 4)) {
+        ProteinGraph pg(num_acc, input, strings);
+
+        // Compute the layout of the record first
+        MappedGraphHeader gh = {};
+        gh.num_acc = pg.accessions.size();
+        gh.N = pg.N;
+        gh.E = pg.E;
+        gh.PDB = pg.PDB;
+        gh.num_variant_edges = pg.num_variant_edges;
+
+        std::uint64_t acc_size = 0;
+        for (auto const& acc : pg.accessions) {
+            acc_size += acc.length() + 1;
+        }
+
+        std::uint64_t rel = sizeof(MappedGraphHeader);
+        auto place = [&rel](std::uint64_t size) {
+            std::uint64_t column = align_offset(rel);
+            rel = column + size;
+            return column;
+        };
+        gh.accessions = place(acc_size);
+        gh.nodes = place(pg.N * sizeof(std::uint32_t));
+        gh.edges = place(pg.E * sizeof(std::uint32_t));
+        gh.sequence_str_index = place(pg.N * sizeof(std::uint32_t));
+        gh.position = place(pg.N * sizeof(std::uint16_t));
+        gh.iso_index = place(pg.N * sizeof(std::uint8_t));
+        gh.iso_position = place(pg.N * sizeof(std::uint16_t));
+        gh.mono_weight = place(pg.N * sizeof(double));
+        gh.cleaved = place(pg.E * sizeof(std::uint8_t));
+        gh.qualifiers_str_index = place(pg.E * sizeof(std::uint32_t));
+        gh.variant_count = place(pg.E * sizeof(std::uint8_t));
+        gh.pdb_offsets = place(((std::uint64_t) pg.N + 1) * sizeof(std::uint32_t));
+        gh.pdbs = place((std::uint64_t) pg.pdb_offsets[pg.N] * sizeof(double));
+        gh.record_size = rel;
+
+        // Write the record itself (in the same order as placed above)
+        write_padding(output, offset);
+        std::uint64_t record_offset = offset;
+        record_offsets.push_back(record_offset);
+        write_column(output, offset, &gh, sizeof(gh));
+        write_padding(output, offset);
+        for (auto const& acc : pg.accessions) {
+            output.write(acc.c_str(), acc.length() + 1);
+            offset += acc.length() + 1;
+        }
+        write_column(output, offset, pg.nodes, pg.N * sizeof(std::uint32_t));
+        write_column(output, offset, pg.edges, pg.E * sizeof(std::uint32_t));
+        write_column(output, offset, pg.sequence_str_index, pg.N * sizeof(std::uint32_t));
+        write_column(output, offset, pg.position, pg.N * sizeof(std::uint16_t));
+        write_column(output, offset, pg.iso_index, pg.N * sizeof(std::uint8_t));
+        write_column(output, offset, pg.iso_position, pg.N * sizeof(std::uint16_t));
+        write_column(output, offset, pg.mono_weight, pg.N * sizeof(double));
+        write_column(output, offset, pg.cleaved, pg.E * sizeof(std::uint8_t));
+        write_column(output, offset, pg.qualifiers_str_index, pg.E * sizeof(std::uint32_t));
+        write_column(output, offset, pg.variant_count, pg.E * sizeof(std::uint8_t));
+        write_column(output, offset, pg.pdb_offsets, ((std::uint64_t) pg.N + 1) * sizeof(std::uint32_t));
+        write_column(output, offset, pg.pdbs, (std::uint64_t) pg.pdb_offsets[pg.N] * sizeof(double));
+    }
+    input.close();
+
+    // Append the table of record offsets and finalize the header
+    write_padding(output, offset);
+    header.num_graphs = record_offsets.size();
+    header.table_offset = write_column(output, offset, record_offsets.data(), record_offsets.size() * sizeof(std::uint64_t));
+
+    // Append the strings (in the order of their ids)
+    std::vector<std::uint64_t> string_offsets;
+    std::uint64_t string_offset = 0;
+    for (std::uint32_t i = 0; i < strings->size(); i++) {
+        string_offsets.push_back(string_offset);
+        string_offset += std::strlen(strings->get(i)) + 1;
+    }
+    header.num_strings = string_offsets.size();
+    header.strings_offset = write_column(output, offset, string_offsets.data(), string_offsets.size() * sizeof(std::uint64_t));
+    for (std::uint32_t i = 0; i < strings->size(); i++) {
+        output.write(strings->get(i), std::strlen(strings->get(i)) + 1);
+    }
+    offset += string_offset;
+    output.seekp(0);
+    output.write((const char*) &header, sizeof(header));
+    output.close();
+};
@@ -0,0 +1,130 @@
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#include "mpmc_queue.hpp"
+
+
+// Microbenchmark of the output queue: many producers (the worker threads) push results, which a single consumer
+// (main) pops. Compares the previous queue (one mutex, two condition variables, copying pop) with the MPMCQueue,
+// with single and batched pops and with parking right away instead of spinning first.
+// Usage: protgraphqueuebench [max_threads (128)] [items (1000000)] [result_size (300)]
+
+
+#define BENCH_QUEUE_SIZE 16384
+#define BENCH_POP_BATCH 64
+
+typedef std::tuple<std::size_t, std::size_t, std::size_t, std::string> Result;  // As in the VarLimitter (batch, query, graph, FASTA)
+
+
+// Previous queue of the traversals
+template<class T, size_t MaxQueueSize>
+class Queue
+{
+    std::condition_variable consumer_, producer_;
+    std::mutex mutex_;
+    using unique_lock = std::unique_lock<std::mutex>;
+
+    std::queue<T> queue_;
+
+public:
+    template<class U>
+    void push_back(U&& item) {
+        unique_lock lock(mutex_);
+        while(MaxQueueSize == queue_.size())
+            producer_.wait(lock);
+        queue_.push(std::forward<U>(item));
+        consumer_.notify_one();
+    }
+
+    T pop_front() {
+        unique_lock lock(mutex_);
+        while(queue_.empty())
+            consumer_.wait(lock);
+        auto full = MaxQueueSize == queue_.size();
+        auto item = queue_.front();
+        queue_.pop();
+        if(full)
+            producer_.notify_all();
+        return item;
+    }
+};
+
+
+// Items per second of num_producers pushing items (in total) to one consumer
+template<class Q, bool Batched>
+double run(std::size_t num_producers, std::size_t items, const std::string& result, std::size_t spin_limit) {
+    Q* queue;
+    if constexpr (std::is_same_v<Q, Queue<Result, BENCH_QUEUE_SIZE>>) {
+        queue = new Q();
+    } else {
+        queue = new Q(spin_limit);
+    }
+
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    std::vector<std::thread> producers;
+    for (std::size_t t = 0; t < num_producers; t++) {
+        producers.push_back(std::thread([&, t]() {
+            for (std::size_t i = t; i < items; i += num_producers) {
+                queue->push_back(Result(t, i, i, result));
+            }
+        }));
+    }
+
+    std::size_t bytes = 0;
+    std::vector<Result> popped;
+    for (std::size_t i = 0; i < items;) {
+        if constexpr (Batched) {
+            popped.clear();
+            i += queue->pop_batch(popped, BENCH_POP_BATCH);
+            for (auto const& item : popped) { bytes += std::get<3>(item).size(); }
+        } else {
+            bytes += std::get<3>(queue->pop_front()).size();
+            i++;
+        }
+    }
+    for (auto& producer : producers) {
+        producer.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    delete queue;
+    if (bytes != items * result.size()) {
+        std::fprintf(stderr, "Lost results in the benchmark\n");
+        std::exit(1);
+    }
+    return items / seconds;
+}
+
+
+int main(int argc, char *argv[]) {
+    std::size_t max_threads = (argc > 1) ? std::stoull(argv[1]) : 128;
+    std::size_t items = (argc > 2) ? std::stoull(argv[2]) : 1000000;
+    std::string result((argc > 3) ? std::stoull(argv[3]) : 300, 'A');
+
+    typedef Queue<Result, BENCH_QUEUE_SIZE> MutexQueue;
+    typedef MPMCQueue<Result, BENCH_QUEUE_SIZE> LockFreeQueue;
+
+    std::printf("Results per second (millions) of <threads> producers to one consumer\n");
+    std::printf("%8s %12s %12s %12s %12s\n", "threads", "mutex", "mpmc", "mpmc-batch", "mpmc-park");
+    for (std::size_t threads = 1; threads <= max_threads; threads *= 2) {
+        std::printf("%8zu %12.3f %12.3f %12.3f %12.3f\n", threads,
+            run<MutexQueue, false>(threads, items, result, 0) / 1e6,
+            run<LockFreeQueue, false>(threads, items, result, QUEUE_SPIN_LIMIT) / 1e6,
+            run<LockFreeQueue, true>(threads, items, result, QUEUE_SPIN_LIMIT) / 1e6,
+            run<LockFreeQueue, true>(threads, items, result, 0) / 1e6
+        );
+        std::fflush(stdout);
+    }
+    return 0;
+}
@@ -0,0 +1,73 @@
+#include "string_pool.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <string_view>
+
+
+StringPool::~StringPool() {
+    for (auto& segment : this->segments) {
+        delete[] segment.load();
+    }
+}
+
+
+std::uint32_t StringPool::intern(std::string_view str) {
+    Shard& shard = this->shards[std::hash<std::string_view>{}(str) % STRING_POOL_SHARDS];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto found = shard.ids.find(str);
+    if (found != shard.ids.end()) {
+        return found->second;
+    }
+
+    // New string, the key of the map points into the storage of the pool
+    const char* stored = this->store(shard, str);
+    std::uint32_t id = this->next_id.fetch_add(1);
+    this->publish(id, stored);
+    shard.ids.emplace(std::string_view(stored, str.length()), id);
+    return id;
+}
+
+
+std::uint32_t StringPool::adopt(const char* str) {
+    std::uint32_t id = this->next_id.fetch_add(1);
+    this->publish(id, str);
+    return id;
+}
+
+
+// Copies the string (with its terminating \0) into the chunks of the shard
+const char* StringPool::store(Shard& shard, std::string_view str) {
+    std::size_t size = str.length() + 1;
+    if (shard.chunk_used + size > STRING_POOL_CHUNK_SIZE) {
+        // Start a new chunk (strings larger than a chunk get their own, which is full afterwards)
+        shard.chunks.push_back(std::make_unique<char[]>(std::max<std::size_t>(size, STRING_POOL_CHUNK_SIZE)));
+        shard.chunk_used = 0;
+    }
+    char* stored = shard.chunks.back().get() + shard.chunk_used;
+    std::memcpy(stored, str.data(), str.length());
+    stored[str.length()] = '\0';
+    shard.chunk_used += size;
+    return stored;
+}
+
+
+// Makes the string available under its id (allocates the segment of the id table if needed)
+void StringPool::publish(std::uint32_t id, const char* str) {
+    std::uint64_t pos = (std::uint64_t) id + (1 << STRING_POOL_FIRST_SEGMENT_BITS);
+    int segment = std::bit_width(pos) - 1 - STRING_POOL_FIRST_SEGMENT_BITS;
+
+    const char** entries = this->segments[segment].load(std::memory_order_acquire);
+    if (entries == nullptr) {
+        const char** allocated = new const char*[(std::uint64_t) 1 << (segment + STRING_POOL_FIRST_SEGMENT_BITS)];
+        if (this->segments[segment].compare_exchange_strong(entries, allocated, std::memory_order_acq_rel)) {
+            entries = allocated;
+        } else {
+            delete[] allocated;  // Another thread was faster, entries is its segment now
+        }
+    }
+    entries[pos - ((std::uint64_t) 1 << (segment + STRING_POOL_FIRST_SEGMENT_BITS))] = str;
+}
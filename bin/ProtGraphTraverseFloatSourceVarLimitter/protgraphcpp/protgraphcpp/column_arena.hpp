@@ -0,0 +1,46 @@
+#ifndef COLUMNARENA_H
+#define COLUMNARENA_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <memory>
+#include <new>
+
+
+#define ARENA_ALIGNMENT 64  // Each column starts on its own cache line
+
+
+// A single allocation, from which the columns of a graph are carved one after another. The size
+// has to be known up front (sum of aligned(...) of all columns). Freed when the arena is dropped.
+class ColumnArena {
+    public:
+        ColumnArena() = default;
+        explicit ColumnArena(std::size_t size) {
+            if (size != 0) {
+                this->data.reset((char*) std::aligned_alloc(ARENA_ALIGNMENT, size));
+                if (!this->data) throw std::bad_alloc();
+            }
+        };
+
+        // Bytes needed in the arena for a column of num entries
+        template<class T>
+        static std::size_t aligned(std::size_t num) {
+            return (num * sizeof(T) + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT * ARENA_ALIGNMENT;
+        }
+
+        // Next column of num entries (uninitialized)
+        template<class T>
+        T* carve(std::size_t num) {
+            T* column = (T*) (this->data.get() + this->used);
+            this->used += aligned<T>(num);
+            return column;
+        }
+
+    private:
+        struct Free { void operator()(char* ptr) const { std::free(ptr); } };
+        std::unique_ptr<char, Free> data;
+        std::size_t used = 0;
+};
+
+
+#endif
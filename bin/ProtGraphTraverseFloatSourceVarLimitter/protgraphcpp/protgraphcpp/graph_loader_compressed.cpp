@@ -0,0 +1,282 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <exception>
+#include <fstream>
+#include <endian.h>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <streambuf>
+#include <thread>
+#include <zlib.h>
+#include "compressed_graph_format.hpp"
+#include "graph_loader.hpp"
+#include "protein_graph.hpp"
+#include "string_pool.hpp"
+#include <unordered_map>
+#include <vector>
+
+
+// Read-only stream buffer over a decoded graph, so that it is parsed exactly like a BPCSR-file
+class RecordBuffer: public std::streambuf {
+    public:
+        RecordBuffer(char* data, std::size_t size) { this->setg(data, data, data + size); }
+
+    protected:
+        pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode) override {
+            char* base = (dir == std::ios_base::beg) ? this->eback() : (dir == std::ios_base::cur) ? this->gptr() : this->egptr();
+            if (base + off < this->eback() || base + off > this->egptr()) {
+                return pos_type(off_type(-1));
+            }
+            this->setg(this->eback(), base + off, this->egptr());
+            return pos_type(this->gptr() - this->eback());
+        }
+        pos_type seekpos(pos_type pos, std::ios_base::openmode which) override {
+            return this->seekoff(off_type(pos), std::ios_base::beg, which);
+        }
+};
+
+
+// Encoding of the numeric columns (zigzag varints of the differences, see compressed_graph_format.hpp)
+static void put_varint(std::string& out, std::uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back((char) ((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    out.push_back((char) value);
+}
+
+static std::uint64_t get_varint(const char*& in, const char* end) {
+    std::uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (in == end) break;
+        std::uint8_t byte = *in++;
+        value |= (std::uint64_t) (byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) return value;
+    }
+    throw std::runtime_error("Corrupt varint in CPCSR-block");
+}
+
+// Transcodes a column of num big-endian values of W bytes (encode: BPCSR --> varints, decode: varints --> BPCSR)
+template<std::size_t W, bool Encode>
+static void transcode_column(const char*& in, const char* end, std::uint64_t num, std::string& out) {
+    std::uint64_t previous = 0;
+    for (std::uint64_t i = 0; i < num; i++) {
+        if constexpr (Encode) {
+            if ((std::size_t) (end - in) < W) throw std::runtime_error("Truncated graph in CPCSR-conversion");
+            std::uint64_t value = 0;
+            for (std::size_t b = 0; b < W; b++) {
+                value = (value << 8) | (std::uint8_t) in[b];
+            }
+            in += W;
+            std::int64_t delta = (std::int64_t) (value - previous);
+            put_varint(out, ((std::uint64_t) delta << 1) ^ (std::uint64_t) (delta >> 63));
+            previous = value;
+        } else {
+            std::uint64_t zigzag = get_varint(in, end);
+            std::uint64_t value = previous + ((zigzag >> 1) ^ (~(zigzag & 1) + 1));
+            for (std::size_t b = 0; b < W; b++) {
+                out.push_back((char) (value >> (8 * (W - 1 - b))));
+            }
+            previous = value;
+        }
+    }
+}
+
+// Walks the layout of a BPCSR-record (see ProteinGraph), copying the strings and bytes and transcoding the numeric columns
+template<bool Encode>
+static void transcode_graph(const char* in, const char* end, std::string& out) {
+    auto bytes = [&](std::uint64_t num) {
+        if ((std::uint64_t) (end - in) < num) throw std::runtime_error("Truncated graph in CPCSR-conversion");
+        out.append(in, num);
+        in += num;
+    };
+    auto strings = [&](std::uint64_t num) {
+        for (std::uint64_t i = 0; i < num; i++) {
+            const char* terminator = (const char*) std::memchr(in, '\0', end - in);
+            if (terminator == nullptr) throw std::runtime_error("Truncated graph in CPCSR-conversion");
+            bytes(terminator - in + 1);
+        }
+    };
+
+    std::uint32_t header[4];  // num_acc, N, E, PDB (big endian)
+    if (end - in < (std::ptrdiff_t) sizeof(header)) throw std::runtime_error("Truncated graph in CPCSR-conversion");
+    std::memcpy(header, in, sizeof(header));
+    bytes(sizeof(header));
+    std::uint64_t num_acc = be32toh(header[0]), num_n = be32toh(header[1]), num_e = be32toh(header[2]), num_pdbs = be32toh(header[3]);
+
+    strings(num_acc);  // AC
+    transcode_column<4, Encode>(in, end, num_n, out);  // NO
+    transcode_column<4, Encode>(in, end, num_e, out);  // ED
+    strings(num_n);  // SQ
+    transcode_column<2, Encode>(in, end, num_n, out);  // PO
+    bytes(num_n);  // IS
+    transcode_column<2, Encode>(in, end, num_n, out);  // IP
+    transcode_column<8, Encode>(in, end, num_n, out);  // MW
+    bytes(num_e);  // CL
+    strings(num_e);  // QU
+    bytes(num_e);  // VC
+    transcode_column<8, Encode>(in, end, num_n * 2 * num_pdbs, out);  // PDB
+}
+
+
+std::vector<ProteinGraph>* GraphLoaderCompressed::loadGraphs(std::string fileLoc, std::unordered_map<std::string, std::vector<uint8_t>> max_vars) {
+    std::ifstream input(fileLoc, std::ios::binary);
+    if (!input) {
+        throw std::runtime_error("Could not open CPCSR-file: " + fileLoc);
+    }
+
+    // Check the header and read the block table
+    CompressedFileHeader header;
+    input.read((char*) &header, sizeof(header));
+    if (!input || std::memcmp(header.magic, CPCSR_MAGIC, sizeof(header.magic)) != 0) {
+        throw std::runtime_error("Not a CPCSR-file: " + fileLoc);
+    }
+    if (le32toh(header.version) != CPCSR_VERSION) {
+        throw std::runtime_error("CPCSR-file has version " + std::to_string(le32toh(header.version)) + ", expected " + std::to_string(CPCSR_VERSION) + ". Please reconvert: " + fileLoc);
+    }
+    std::vector<CompressedBlockEntry> blocks(le64toh(header.num_graphs));
+    input.seekg(le64toh(header.table_offset));
+    input.read((char*) blocks.data(), blocks.size() * sizeof(CompressedBlockEntry));
+    if (!input) {
+        throw std::runtime_error("Could not read the block table of the CPCSR-file: " + fileLoc);
+    }
+    input.close();
+    for (auto& block : blocks) {
+        block = {le64toh(block.offset), le64toh(block.size), le64toh(block.encoded_size), le64toh(block.record_size)};
+    }
+
+    std::vector<ProteinGraph>* pgs = new std::vector<ProteinGraph>;  // Ptr to vector
+    pgs->resize(blocks.size());
+    std::vector<char> accepted(blocks.size(), 0);  // Graphs which passed the accession filter
+    std::shared_ptr<StringPool> strings = std::make_shared<StringPool>();  // Shared by the loaded graphs (interned concurrently)
+
+    // Decompress and parse concurrently, each thread takes the next block and places its graph at its position in the file
+    std::atomic<std::size_t> next_graph{0};
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    auto parse_graphs = [&]() {
+        std::ifstream input(fileLoc, std::ios::binary);
+        std::string compressed, encoded, record;  // Reused for all blocks of this thread
+        try {
+            for (std::size_t i = next_graph.fetch_add(1); i < blocks.size(); i = next_graph.fetch_add(1)) {
+                compressed.resize(blocks[i].size);
+                input.seekg(blocks[i].offset);
+                input.read(compressed.data(), compressed.size());
+
+                encoded.resize(blocks[i].encoded_size);
+                uLongf encoded_size = encoded.size();
+                if (!input || uncompress((Bytef*) encoded.data(), &encoded_size, (const Bytef*) compressed.data(), compressed.size()) != Z_OK || encoded_size != encoded.size()) {
+                    throw std::runtime_error("Corrupt block " + std::to_string(i) + " in CPCSR-file: " + fileLoc);
+                }
+
+                record.clear();
+                record.reserve(blocks[i].record_size);
+                transcode_graph<false>(encoded.data(), encoded.data() + encoded.size(), record);
+                if (record.size() != blocks[i].record_size) {
+                    throw std::runtime_error("Corrupt block " + std::to_string(i) + " in CPCSR-file: " + fileLoc);
+                }
+
+                if (!this->acceptsAccession(record.data() + 16)) continue;  // The first accession follows the counts
+                accepted[i] = 1;
+
+                RecordBuffer buffer(record.data(), record.size());
+                std::istream record_stream(&buffer);
+                uint32_t num_acc;
+                record_stream.read((char*) &num_acc, 4);
+                (*pgs)[i] = ProteinGraph(num_acc, record_stream, strings, max_vars, this->columns);
+                this->pruneGraph((*pgs)[i]);
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if (!error) error = std::current_exception();
+            next_graph = blocks.size();  // Let the other threads stop early
+        }
+        input.close();
+    };
+
+    std::vector<std::thread> threads;
+    for (uint32_t t = 0; t < std::max(this->num_threads, (uint32_t) 1); t++) {
+        threads.push_back(std::thread(parse_graphs));
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    if (error) {
+        delete pgs;
+        std::rethrow_exception(error);
+    }
+
+    // Close the gaps of the skipped graphs
+    std::size_t num_accepted = 0;
+    for (std::size_t i = 0; i < blocks.size(); i++) {
+        if (!accepted[i]) continue;
+        if (num_accepted != i) {
+            (*pgs)[num_accepted] = std::move((*pgs)[i]);  // (a graph must not be moved onto itself)
+        }
+        num_accepted++;
+    }
+    pgs->resize(num_accepted);
+
+    return pgs;
+};
+
+
+void GraphLoaderCompressed::convert(std::string bpcsrLoc, std::string cpcsrLoc) {
+    std::vector<GraphIndexEntry> index = GraphLoaderBinary::scanIndex(bpcsrLoc);
+    std::ifstream input(bpcsrLoc, std::ios::binary);
+    if (!input) {
+        throw std::runtime_error("Could not open BPCSR-file: " + bpcsrLoc);
+    }
+    std::ofstream output(cpcsrLoc, std::ios::binary | std::ios::trunc);
+    if (!output) {
+        throw std::runtime_error("Could not create CPCSR-file: " + cpcsrLoc);
+    }
+
+    // Placeholder header, it is rewritten at the end
+    CompressedFileHeader header = {};
+    std::memcpy(header.magic, CPCSR_MAGIC, sizeof(header.magic));
+    header.version = htole32(CPCSR_VERSION);
+    output.write((const char*) &header, sizeof(header));
+    std::uint64_t offset = sizeof(header);
+
+    // Compress graph by graph (only one graph is kept in memory)
+    std::vector<CompressedBlockEntry> blocks;
+    std::string record, encoded, compressed;
+    for (auto const& entry : index) {
+        record.resize(entry.size);
+        input.seekg(entry.offset);
+        input.read(record.data(), record.size());
+        if (!input) {
+            throw std::runtime_error("Could not read graph " + entry.accession + " from: " + bpcsrLoc);
+        }
+
+        encoded.clear();
+        transcode_graph<true>(record.data(), record.data() + record.size(), encoded);
+        uLongf compressed_size = compressBound(encoded.size());
+        compressed.resize(compressed_size);
+        if (compress2((Bytef*) compressed.data(), &compressed_size, (const Bytef*) encoded.data(), encoded.size(), Z_BEST_COMPRESSION) != Z_OK) {
+            throw std::runtime_error("Could not compress graph " + entry.accession);
+        }
+
+        output.write(compressed.data(), compressed_size);
+        blocks.push_back({htole64(offset), htole64(compressed_size), htole64(encoded.size()), htole64(record.size())});
+        offset += compressed_size;
+    }
+    input.close();
+
+    // Append the block table and finalize the header
+    output.write((const char*) blocks.data(), blocks.size() * sizeof(CompressedBlockEntry));
+    header.num_graphs = htole64(blocks.size());
+    header.table_offset = htole64(offset);
+    output.seekp(0);
+    output.write((const char*) &header, sizeof(header));
+    if (!output) {
+        throw std::runtime_error("Could not write CPCSR-file: " + cpcsrLoc);
+    }
+    output.close();
+}
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <atomic>
 #include <cerrno>
 #include <condition_variable>
@@ -8,7 +9,6 @@
 #include <fstream>
 #include <mutex>
 #include <ostream>
-#include <queue>
 #include <sstream>
 #include <string>
 #include <sys/types.h>
@@ -18,6 +18,8 @@
 #include <thread>
 #include <tuple>
 #include <chrono>
+#include <stdexcept>
+#include <unordered_set>
 #include <unordered_map>
 #include <cmath>
 
@@ -25,118 +27,315 @@
 
 #include "protein_graph.hpp"
 #include "graph_loader.hpp"
+#include "mpmc_queue.hpp"
+#include "task_scheduler.hpp"
+#include "graph_costs.hpp"
 
 
-#define QUEUE_SIZE 10000
+#define QUEUE_SIZE 16384  // Capacity of the output queue (a power of two, see MPMCQueue)
+#define QUEUE_POP_BATCH 64  // Results, which are taken from the output queue at once
+#define QUERIES_IN_FLIGHT 4  // Default number of batches of queries, which are executed at once
 
-template<class T, size_t MaxQueueSize>
-class Queue
-{
-    std::condition_variable consumer_, producer_;
-    std::mutex mutex_;
-    using unique_lock = std::unique_lock<std::mutex>;
 
-    std::queue<T> queue_;
+// A graph of a batch, which is traversed in parts (one task each, see ProteinGraph::naive_paths). The task of its
+// last part merges the paths of all parts.
+struct SplitGraph {
+    std::vector<std::vector<std::vector<std::vector<uint32_t>>>> paths;  // Per part and query of the batch
+    std::atomic<std::uint32_t> remaining{0};  // Parts, which are not executed yet
+    std::atomic<double> seconds{0};  // Runtime of the executed parts
+};
 
-public:
-    template<class U>
-    void push_back(U&& item) {
-        unique_lock lock(mutex_);
-        while(MaxQueueSize == queue_.size())
-            producer_.wait(lock);
-        queue_.push(std::forward<U>(item));
-        consumer_.notify_one();
-    }
+// A batch of queries in flight (see serve_queries), the threads read its windows and bins while executing its tasks
+struct BatchState {
+    std::vector<std::tuple<int64_t, int64_t>> windows;  // Queries, which are answered in one pass
+    std::vector<uint32_t> used_bins;  // Bin to use (per query)
+    std::vector<std::unique_ptr<SplitGraph>> splits;  // Graphs, which are traversed in parts
+    std::vector<std::vector<std::pair<std::size_t, std::string>>> outputs;  // Per query: graph and its results (collected by serve_queries)
+    std::atomic<std::size_t> remaining{0};  // Tasks, which are not executed yet
+    bool finished = false;  // All tasks are executed and their results collected
+    std::vector<ProteinGraph>* pgs = nullptr;  // Graphs of the batch (with their loader and costs, see serve_queries)
+    GraphLoader* gl = nullptr;
+    GraphCosts* costs = nullptr;
+};
 
-    T pop_front() {
-        unique_lock lock(mutex_);
-        while(queue_.empty())
-            consumer_.wait(lock);
-        auto full = MaxQueueSize == queue_.size();
-        auto item = queue_.front();
-        queue_.pop();
-        if(full)
-            producer_.notify_all();
-        return item;
-    }
+// A graph (or a part of it) to traverse for a batch (numbered in submission order, its state is
+// batches[batch % batches.size()]). A graph in parts > 1 parts is state.splits[split].
+struct GraphTask {
+    std::size_t batch;
+    std::size_t graph;
+    std::uint32_t part;
+    std::uint32_t parts;
+    std::size_t split;
 };
 
+typedef std::tuple<std::size_t, std::size_t, std::size_t, std::string, bool> Result;  // Batch, query, graph, its results and whether all tasks of the batch are executed
+
 
-// TODO output queue
+// Executes the tasks (graphs of any batch in flight) which the scheduler hands to this thread. The thread which
+// executes the last task of a batch reports it as finished.
 void thread_lifecycle(
-    Queue<std::tuple<int64_t, int64_t, uint8_t>, QUEUE_SIZE>& query, 
-    Queue<std::string, QUEUE_SIZE>& output_queue,
-    std::vector<ProteinGraph>& pgs,
-    std::atomic<bool>* pgs_executed,
-    std::atomic<uint32_t>& atomic_pgs_finished,
-    int64_t max_query,
-    uint32_t num_bins
+    TaskScheduler<GraphTask>& scheduler,
+    std::size_t thread,
+    std::vector<BatchState>& batches,
+    MPMCQueue<Result, QUEUE_SIZE>& output_queue,
+    bool merge
     ){
 
-        bool iter_bool = false, should_execute = iter_bool;
-
-        std::tuple<int64_t, int64_t, uint8_t> next_query;
-        std::string output_benchmark = "";
+        std::vector<std::string> output_benchmark;  // Per query of the batch
+        std::vector<Result> outputs;  // Pushed at once
+        std::vector<std::vector<std::vector<uint32_t>>> part_paths;  // Of a split graph (per part)
 
         int64_t lower, upper;
-        uint32_t used_bin;
+        std::vector<uint8_t> batch_vars_max;
         uint8_t num_vars_max;
-        while(true) {
-            // Get next query
-            next_query = query.pop_front();
+        GraphTask task;
+        std::size_t i;
+        while(scheduler.next(thread, task)) {
+            BatchState& state = batches[task.batch % batches.size()];
+            const std::vector<std::tuple<int64_t, int64_t>>& next_batch = state.windows;
+            std::vector<ProteinGraph>& pgs = *state.pgs;
+            GraphLoader& gl = *state.gl;
+            GraphCosts& costs = *state.costs;
+            i = task.graph;
+
+            output_benchmark.assign(next_batch.size(), "");
+            part_paths.resize(task.parts);
+            gl.acquireGraph(pgs, i);
+            std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+            if (next_batch.size() == 1) {
+                lower = std::get<0>(next_batch[0]);
+                upper = std::get<1>(next_batch[0]);
+                num_vars_max = pgs.at(i).max_vars_bins[state.used_bins[0]];
+                if (merge) {
+                    output_benchmark[0] += pgs.at(i).tvs_traverse_merged(lower,  upper, num_vars_max);
+                } else if (task.parts > 1) {
+                    state.splits[task.split]->paths[task.part] = {(num_vars_max == 255) ? pgs.at(i).naive_paths(lower, upper, task.part, task.parts) : pgs.at(i).varcount_paths(lower, upper, num_vars_max, task.part, task.parts)};
+                } else if (num_vars_max == 255) {
+                    output_benchmark[0] += pgs.at(i).tvs_traverse_naive(lower,  upper);
+                } else {
+                    output_benchmark[0] += pgs.at(i).tvs_traverse_varcount_naive(lower,  upper, num_vars_max);
+                }
+            } else {
+                // All queries of the batch in one pass over the graph
+                batch_vars_max.clear();
+                for (uint32_t used_bin : state.used_bins) {
+                    batch_vars_max.push_back(pgs.at(i).max_vars_bins[used_bin]);
+                }
+                if (task.parts > 1) {
+                    state.splits[task.split]->paths[task.part] = pgs.at(i).batch_paths(next_batch, batch_vars_max, task.part, task.parts);
+                } else {
+                    output_benchmark = pgs.at(i).tvs_traverse_batch(next_batch, batch_vars_max);
+                }
+            }
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+            if (task.parts > 1) {
+                // The last part merges the paths (per query) and records the runtime of all parts
+                SplitGraph& split = *state.splits[task.split];
+                split.seconds.fetch_add(seconds);
+                if (split.remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    for (std::size_t q = 0; q < next_batch.size(); q++) {
+                        for (std::uint32_t p = 0; p < task.parts; p++) {
+                            part_paths[p] = std::move(split.paths[p][q]);
+                        }
+                        std::vector<std::vector<uint32_t>> full_paths = ProteinGraph::merge_parts(part_paths);
+                        if (full_paths.size() != 0) {
+                            output_benchmark[q] = pgs.at(i).convert_paths_to_fasta(full_paths);
+                        }
+                    }
+                    costs.measured(i, split.seconds.load());
+                }
+            } else {
+                costs.measured(i, seconds);
+            }
+            gl.releaseGraph(pgs, i);
+
+
+            outputs.clear();
+            for (std::size_t q = 0; q < output_benchmark.size(); q++) {
+                if (output_benchmark[q].length() != 0) {
+                    outputs.push_back(Result(task.batch, q, i, std::move(output_benchmark[q]), false));
+                }
+            }
+            if (!outputs.empty()) {
+                output_queue.push_batch(outputs);  // Before the batch can be reported as finished
+            }
+            if (state.remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                //  Only the thread of the last task of the batch gets here
+                output_queue.push_back(Result(task.batch, 0, 0, "", true));
+            }
+        }
+
+}
+
+// The worker threads (see thread_lifecycle) with their scheduler, output queue and the batches in flight. It is
+// started once and serves all calls of serve_queries (one per chunk of graphs when streaming).
+struct WorkerPool {
+    TaskScheduler<GraphTask> scheduler;
+    MPMCQueue<Result, QUEUE_SIZE> output_queue;
+    std::vector<BatchState> batches;
+    std::vector<std::thread> threads;
+
+    WorkerPool(int num_threads, std::size_t max_in_flight, bool merge) : scheduler(num_threads), batches(std::max<std::size_t>(max_in_flight, 1)) {
+        std::cout << "Starting Threads" << std::endl;
+        for (int i = 0; i < num_threads; i++) {
+            this->threads.push_back(std::thread(
+                thread_lifecycle, // Method
+                std::ref(this->scheduler), i, std::ref(this->batches), std::ref(this->output_queue), merge //Params
+            ));
+        }
+    };
+
+    // Spin down
+    ~WorkerPool() {
+        this->scheduler.stop();
+        for (auto& thread : this->threads) {
+            thread.join();
+        }
+    };
+};
 
-            // Stop Condition reached terminate thread
-            if (std::get<2>(next_query) == uint8_t(-1)) break;
+// Serves all queries on the graphs with the threads of pool, batch_size queries are answered in one pass over each
+// graph. Up to as many batches as the pool holds are executed at once, so that the threads do not idle at the end of
+// a batch. The graphs of a batch are dispatched most expensive first (see GraphCosts), a graph costing more than an
+// even share of the batch is traversed in up to graph_threads parts, which are separate tasks. The results of each
+// query are written to output (in query order, and per query in graph order), query_ends receives the output
+// position after each query if set. The progress is reported per query if report_progress is set.
+void serve_queries(
+    WorkerPool& pool,
+    std::vector<ProteinGraph>& pgs,
+    GraphLoader& gl,
+    const std::vector<std::tuple<int64_t, int64_t>>& queries,
+    int num_threads,
+    int64_t max_query,
+    uint32_t num_bins,
+    bool merge,
+    std::size_t batch_size,
+    std::uint32_t graph_threads,
+    std::ostream& output_file,
+    std::vector<uint64_t>* query_ends,
+    bool report_progress
+    ){
+    std::vector<BatchState>& batches = pool.batches;
+
+    // The graphs to traverse for each batch: all graphs with limits (the others are never traversed)
+    std::vector<std::size_t> graphs;
+    for (std::size_t i = 0; i < pgs.size(); i++) {
+        if (pgs[i].num_bins != 0) {
+            graphs.push_back(i);
+        }
+    }
+    std::vector<double> estimates;
+    for (std::size_t graph : graphs) {
+        estimates.push_back(gl.estimatedCost(pgs, graph));
+    }
+    GraphCosts costs(pgs.size(), graphs, estimates);
 
-            //Set query params
-            lower = std::get<0>(next_query);
-            upper = std::get<1>(next_query);
 
-            // Get the bin to use
-            used_bin = (uint32_t) std::ceil( (upper / (max_query / num_bins))) - 1;
-            if (used_bin >= num_bins) {
-                used_bin = num_bins - 1;
+    // Now serve queries
+    int query_counter = 1;
+    std::size_t num_batches = (queries.size() + batch_size - 1) / batch_size;
+    std::size_t submitted = 0, written = 0;
+    std::vector<GraphTask> tasks;
+    std::vector<Result> outputs;
+    while (written < num_batches) {
+        // Submit batches until max_in_flight are in flight
+        while (submitted < num_batches && submitted - written < batches.size()) {
+            BatchState& state = batches[submitted % batches.size()];
+            std::size_t first = submitted * batch_size;
+            state.windows.assign(queries.begin() + first, queries.begin() + std::min(first + batch_size, queries.size()));
+
+            // Get the bin to use (per query)
+            state.used_bins.clear();
+            for (auto const& window : state.windows) {
+                state.used_bins.push_back((uint32_t) std::ceil( (std::get<1>(window) / (max_query / num_bins))) - 1);
+                if (state.used_bins.back() >= num_bins) {
+                    state.used_bins.back() = num_bins - 1;
+                }
             }
 
+            //Submit Query
+            state.outputs.assign(state.windows.size(), {});
+            state.splits.clear();
+            tasks.clear();
+            const std::vector<std::size_t>& order = costs.order();
+            for (std::size_t k = 0; k < order.size(); k++) {
+                // Split the graph into parts (not beyond its start edges), merged traversals are never split
+                std::uint32_t parts = merge ? 1 : std::min({costs.parts(k, num_threads), graph_threads, gl.startEdges(pgs, order[k])});
+                if (parts <= 1) {
+                    tasks.push_back(GraphTask{submitted, order[k], 0, 1, 0});
+                    continue;
+                }
+                state.splits.push_back(std::make_unique<SplitGraph>());
+                state.splits.back()->paths.resize(parts);
+                state.splits.back()->remaining.store(parts, std::memory_order_relaxed);
+                for (std::uint32_t part = 0; part < parts; part++) {
+                    tasks.push_back(GraphTask{submitted, order[k], part, parts, state.splits.size() - 1});
+                }
+            }
+            state.finished = tasks.empty();
+            state.remaining.store(tasks.size(), std::memory_order_relaxed);
+            state.pgs = &pgs;
+            state.gl = &gl;
+            state.costs = &costs;
+            pool.scheduler.submit(tasks);
+            submitted++;
+        }
 
-            // Scan bool vector
-            for (uint32_t i = 0; i < pgs.size(); i++){
-                // Check if it was already executed by another thread
-                pgs_executed[i].compare_exchange_strong(should_execute, !iter_bool);
-                if (should_execute == iter_bool) {
-                    // It was not executed by another thread, execute now!
-                    num_vars_max = pgs.at(i).max_vars_bins[used_bin];
-                    if (num_vars_max == 255) {
-                        output_benchmark += pgs.at(i).tvs_traverse_naive(lower,  upper);
-                    } else {
-                        output_benchmark += pgs.at(i).tvs_traverse_varcount_naive(lower,  upper, num_vars_max);
-                    }
+        // Wait for the results of the oldest batch (the results of the others are collected meanwhile)
+        BatchState& state = batches[written % batches.size()];
+        if (!state.finished) {
+            outputs.clear();
+            pool.output_queue.pop_batch(outputs, QUEUE_POP_BATCH);
+            for (auto& output : outputs) {
+                BatchState& output_state = batches[std::get<0>(output) % batches.size()];
+                if (std::get<4>(output)) {
+                    output_state.finished = true;
+                } else {
+                    output_state.outputs[std::get<1>(output)].emplace_back(std::get<2>(output), std::move(std::get<3>(output)));
+                }
+            }
+            continue;
+        }
 
+        for (std::size_t q = 0; q < state.windows.size(); q++) {
+            // std::cout << output; // E.G.: here we could simply pass it through the socket
+            std::sort(state.outputs[q].begin(), state.outputs[q].end(), [](auto const& a, auto const& b) { return a.first < b.first; });
+            for (auto const& output : state.outputs[q]) {
+                output_file << output.second;
+            }
+            if (query_ends != nullptr) {
+                query_ends->push_back(output_file.tellp());
+            }
 
-                    if (output_benchmark.length() != 0) {
-                        output_queue.push_back(output_benchmark);
-                        output_benchmark = "";
-                    }
-                    int finished_count = atomic_pgs_finished.fetch_add(1, std::memory_order_acq_rel);
-                    if (finished_count >= pgs.size() - 1) {
-                        //  Only 1 Thread should be active here!!!
-                        // std::cerr << "Thread pushing end signal" << std::endl;
-                        output_queue.push_back("TODO FINISHED CALCULATING");
-                        atomic_pgs_finished.exchange(0);
-                    }
-                } 
-                // Update should_execute due to the atomic replacing its value
-                should_execute = iter_bool;
+            if (report_progress) {
+                std::cerr << "Processed Query " << query_counter << " with: " << std::get<0>(state.windows[q]) << ":" << std::get<1>(state.windows[q]) << std::endl;
             }
-            // Update bools
-            iter_bool = !iter_bool;
-            should_execute = iter_bool;
-            
-            
+            query_counter++;
         }
+        state.outputs.clear();
+        written++;
+        // 18 446 744 073.709553
+        //  9 223 372 036.854776
+    }
+}
+
 
+// Reads the accessions of an allow- or deny-list (one accession per line)
+std::unordered_set<std::string> read_accessions(std::string fileLoc) {
+    std::ifstream accessions_file(fileLoc);
+    if (!accessions_file) {
+        throw std::runtime_error("Could not open accession list: " + fileLoc);
+    }
+    std::unordered_set<std::string> accessions;
+    std::string accession;
+    while (std::getline(accessions_file, accession)) {
+        if (!accession.empty() && accession.back() == '\r') accession.pop_back();
+        if (!accession.empty()) accessions.insert(accession);
+    }
+    return accessions;
 }
 
+
 int main(int argc, char *argv[]) {
     // printf("ProtGraphCpp, a (hopefully fast) Peptide Query Engine\n");
 
@@ -186,17 +385,7 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    std::cout << "Loading Graphs" << std::endl;
-    GraphLoader* gl;
-    if (extension.compare("bpcsr") == 0) {
-        gl = new GraphLoaderBinary();
-    }
-
-    // Get Protein Graphs
-    std::vector<ProteinGraph>* pgs = gl->loadGraphs(FILENAME, max_vars);
-    printf("\n");
-
-    // Get the number of available threads
+    // Get the number of available threads (also used for loading)
     int num_threads = 0;
     if (atoi(argv[3]) == -1) {
         num_threads = std::thread::hardware_concurrency();
@@ -204,46 +393,66 @@ int main(int argc, char *argv[]) {
         num_threads = atoi(argv[3]);
     }    
 
-    std::ofstream output_file(argv[4]);
-
-    
-
-    // Set Queues
-    Queue<std::tuple<int64_t, int64_t, uint8_t>, QUEUE_SIZE> query;
-    Queue<std::string, QUEUE_SIZE> output_queue;
-
-    // Set bool vector if executed
-    // std::vector<bool> pgs_executed(pgs->size(), false);
-    // bool* pgs_executed = new bool[pgs->size()];
-    // for (int i = 0; i < pgs->size(); i++){
-    //     pgs_executed[i] = false;
-    // }
-    std::atomic<bool>* pgs_executed = new std::atomic<bool>[pgs->size()];
-    for (int i = 0; i < pgs->size(); i++){
-        pgs_executed[i].exchange(false);
+    // Optional flags (after the positional parameters)
+    bool lazy = false;
+    bool merge = false;
+    std::size_t batch_size = 1;
+    std::size_t in_flight = QUERIES_IN_FLIGHT;
+    std::uint32_t graph_threads = 0;  // 0 --> all threads
+    uint64_t lazy_resident_limit = 0;
+    uint64_t stream_chunk_size = 0;
+    std::string filter_loc;  // Accession list
+    bool filter_deny = false;
+    for (int i = 6; i < argc; i++) {
+        std::string flag = argv[i];
+        if (flag.compare("--lazy") == 0) {
+            lazy = true;
+        } else if (flag.starts_with("--lazy=")) {
+            // Resident limit in MB of loaded graphs, least recently used graphs are evicted above it
+            lazy = true;
+            lazy_resident_limit = (uint64_t) (std::stod(flag.substr(7)) * 1024 * 1024);
+        } else if (flag.starts_with("--stream=")) {
+            // Size in MB (of the BPCSR-file) of the chunks of graphs, which are streamed through all queries
+            stream_chunk_size = (uint64_t) (std::stod(flag.substr(9)) * 1024 * 1024);
+        } else if (flag.compare("--merge") == 0) {
+            // Traverse with merged states (see ProteinGraph::tvs_traverse_merged)
+            merge = true;
+        } else if (flag.starts_with("--batch=")) {
+            // Number of queries, which are answered in one pass over each graph (see ProteinGraph::tvs_traverse_batch)
+            batch_size = std::max(std::stoull(flag.substr(8)), 1ULL);
+        } else if (flag.starts_with("--in-flight=")) {
+            // Number of batches of queries, which are executed at once (their results are still written in query order)
+            in_flight = std::max(std::stoull(flag.substr(12)), 1ULL);
+        } else if (flag.starts_with("--graph-threads=")) {
+            // Most threads, which traverse one expensive graph together (1 --> each graph on one thread)
+            graph_threads = std::max(std::stoul(flag.substr(16)), 1UL);
+        } else if (flag.starts_with("--include=") || flag.starts_with("--exclude=")) {
+            // Only the graphs of the listed accessions (or all but these) are loaded
+            if (!filter_loc.empty()) {
+                std::cerr << "Only one of --include and --exclude can be given" << std::endl;
+                return 1;
+            }
+            filter_deny = flag.starts_with("--exclude=");
+            filter_loc = flag.substr(10);
+        } else {
+            std::cerr << "Unknown parameter: " << flag << std::endl;
+            return 1;
+        }
     }
-
-    // Create atomic counter of executed entries
-    std::atomic<uint32_t> atomic_pgs_finished{0};
-
-
-    // Create Thread pool after retrieving all needed information
-    std::cout << "Starting Threads" << std::endl;
-    std::vector<std::thread> threads;
-    for (int i = 0; i < num_threads; i++) {
-        threads.push_back(std::thread(
-            thread_lifecycle, // Method
-            std::ref(query), std::ref(output_queue), //Params
-            std::ref(*pgs), std::ref(pgs_executed),
-            std::ref(atomic_pgs_finished),
-            bins.back(),
-            num_bins
-            
-        ));
+    if (graph_threads == 0) {
+        graph_threads = std::max(num_threads, 1);
     }
 
+    if (merge && batch_size > 1) {
+        std::cerr << "Only one of --merge and --batch can be given" << std::endl;
+        return 1;
+    }
+    if (stream_chunk_size != 0 && (lazy || extension.compare("bpcsr") != 0)) {
+        std::cerr << "Streaming is only possible for BPCSR-files (and without --lazy)" << std::endl;
+        return 1;
+    }
 
-    // Now serve queries
+    // Read all Queries first (they are served again for each chunk when streaming)
     // TODO Currently we simply read a csv
     std::string QUERY_FILE = argv[2];
     std::ifstream query_file(QUERY_FILE);
@@ -252,7 +461,7 @@ int main(int argc, char *argv[]) {
     std::string entry;
     int64_t lower;
     int64_t upper;
-    int query_counter = 1;
+    std::vector<std::tuple<int64_t, int64_t>> queries;
 
     while (std::getline(query_file, line)) {
         // Parse Query
@@ -262,43 +471,91 @@ int main(int argc, char *argv[]) {
         lower = (int64_t)(std::stod(entry) * 1000000000);
         std::getline(ss_line, entry, '\n');
         upper = (int64_t)(std::stod(entry) * 1000000000);
-        std::tuple<int64_t, int64_t, uint8_t> query_tuple(lower, upper, 1);
+        queries.push_back(std::tuple<int64_t, int64_t>(lower, upper));
+    }
 
-        //Submit Query
-        for (int i = 0; i < num_threads; i++) {
-            query.push_back(query_tuple);
-        }
+    // Heaviest mass of any query, the graphs are pruned to it on loading (queries above the last bin are served too)
+    int64_t max_query_mass = 0;
+    for (auto const& [query_lower, query_upper] : queries) {
+        max_query_mass = std::max(max_query_mass, query_upper);
+    }
 
-        // Wait for the results!
-        while (true) {
-            std::string output = output_queue.pop_front();
-            if (output.starts_with("TODO FINISHED CALCULATING")){
-                break;
-            }
-            // std::cout << output; // E.G.: here we could simply pass it through the socket
-            output_file << output;
+    std::ofstream output_file(argv[4]);
 
+    if (stream_chunk_size != 0) {
+        // Out-of-core: only one chunk of graphs is in memory at a time and runs all queries. The results
+        // of each chunk are spilled next to the output and are merged in query order at the end.
+        GraphLoaderBinary gl(num_threads);
+        gl.pruneToMass(max_query_mass);
+        if (!filter_loc.empty()) {
+            gl.filterAccessions(read_accessions(filter_loc), filter_deny);
+        }
+        std::vector<GraphIndexEntry> index = gl.filterIndex(GraphLoaderBinary::loadIndex(FILENAME));
+
+        std::string spill_loc = std::string(argv[4]) + ".spill";
+        std::fstream spill(spill_loc, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+        std::vector<std::vector<uint64_t>> chunk_query_ends;  // Output position in the spill after each query, per chunk
+
+        // The threads serve all chunks
+        WorkerPool pool(num_threads, in_flight, merge);
+        std::size_t first = 0;
+        while (first < index.size()) {
+            std::size_t last = first;
+            uint64_t chunk_size = 0;
+            do {
+                chunk_size += index[last].size;
+                last++;
+            } while (last < index.size() && chunk_size + index[last].size <= stream_chunk_size);
+
+            std::cout << "Loading Graphs " << first << " to " << last - 1 << std::endl;
+            std::vector<ProteinGraph>* pgs = gl.loadGraphs(FILENAME, index, first, last, max_vars);
+            chunk_query_ends.push_back(std::vector<uint64_t>());
+            serve_queries(pool, *pgs, gl, queries, num_threads, bins.back(), num_bins, merge, batch_size, graph_threads, spill, &chunk_query_ends.back(), last == index.size());
+
+            // Drop the chunk before loading the next one
+            delete pgs;
+            first = last;
         }
 
-        std::cerr << "Processed Query " << query_counter << " with: " << lower << ":" << upper << std::endl;
-        query_counter++;
-        // 18 446 744 073.709553
-        //  9 223 372 036.854776
-    }
-    // Repeat next Query TODO 
+        // Merge: for each query the results of all chunks (which is the order of the in-memory mode)
+        std::vector<char> buffer;
+        for (std::size_t q = 0; q < queries.size(); q++) {
+            uint64_t chunk_begin = 0;
+            for (auto const& query_ends : chunk_query_ends) {
+                uint64_t begin = (q == 0) ? chunk_begin : query_ends[q - 1];
+                buffer.resize(query_ends[q] - begin);
+                spill.seekg(begin);
+                spill.read(buffer.data(), buffer.size());
+                output_file.write(buffer.data(), buffer.size());
+                chunk_begin = query_ends.back();
+            }
+        }
+        spill.close();
+        std::remove(spill_loc.c_str());
+    } else {
+        std::cout << "Loading Graphs" << std::endl;
+        GraphLoader* gl;
+        if (extension.compare("bpcsr") == 0 && lazy) {
+            gl = new GraphLoaderLazy(lazy_resident_limit);  // Via the index "<file>.idx" (built on first use)
+        } else if (extension.compare("bpcsr") == 0) {
+            gl = new GraphLoaderBinary(num_threads);
+        } else if (extension.compare("mpcsr") == 0) {
+            gl = new GraphLoaderMapped();  // Converted via protgraphconvertfloat
+        } else if (extension.compare("cpcsr") == 0) {
+            gl = new GraphLoaderCompressed(num_threads);  // Converted via protgraphconvertfloat
+        }
 
+        if (!filter_loc.empty()) {
+            gl->filterAccessions(read_accessions(filter_loc), filter_deny);
+        }
+        gl->pruneToMass(max_query_mass);
 
+        // Get Protein Graphs
+        std::vector<ProteinGraph>* pgs = gl->loadGraphs(FILENAME, max_vars);
+        printf("\n");
 
-    // Spin down
-    // std::cout << "Spinning Down..." << std::endl;
-    std::tuple<int64_t, int64_t, uint8_t> stop_tuple(0, 0, uint8_t(-1));
-    for (int i = 0; i < num_threads*2; i++)
-    {
-        query.push_back(stop_tuple);
-    }
-    for (int i = 0; i < num_threads; i++)
-    {
-        threads.at(i).join();
+        WorkerPool pool(num_threads, in_flight, merge);
+        serve_queries(pool, *pgs, *gl, queries, num_threads, bins.back(), num_bins, merge, batch_size, graph_threads, output_file, nullptr, true);
     }
 
     // printf("Completely finished!\n");
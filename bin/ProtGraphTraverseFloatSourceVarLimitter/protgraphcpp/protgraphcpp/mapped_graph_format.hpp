@@ -0,0 +1,70 @@
+#ifndef MAPPEDGRAPHFORMAT_H
+#define MAPPEDGRAPHFORMAT_H
+
+#include <cstdint>
+
+// Native (host-endian) on-disk layout of the ProteinGraphs, which can be mmapped directly.
+// Every column is aligned to MPCSR_ALIGNMENT, so the members of a ProteinGraph can point
+// straight into the mapping (no parsing, no copying).
+//
+// File:    [MappedFileHeader][GraphRecord 0][GraphRecord 1]...[uint64_t record offsets][Strings]
+// Record:  [MappedGraphHeader][AC][NO][ED][SQ-Idx][PO][IS][IP][MW][CL][QU-Idx][VC][PDB-Offsets][PDB]
+// Strings: [uint64_t string offsets][chars], the sequences and qualifiers of all graphs (SQ-Idx and
+//          QU-Idx contain ids into it), each '\0'-terminated. Offsets are relative to the chars.
+//
+// All offsets inside a MappedGraphHeader are relative to the beginning of the record. PDB holds the
+// sorted and merged intervals of all nodes, PDB-Offsets (N+1) where they begin per node (as in the ProteinGraph).
+// The edges of each node (ED, CL, QU-Idx and VC) are sorted by the mass of their targets, if the ProteinGraph sorted them.
+
+#define MPCSR_MAGIC "MPCSR\0\0"
+#define MPCSR_VERSION 6
+#define MPCSR_ENDIAN_CHECK 0x01020304
+#define MPCSR_ALIGNMENT 64
+
+#define MPCSR_VALUE_INT64 0
+#define MPCSR_VALUE_DOUBLE 1
+
+
+struct MappedFileHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t endian_check;
+    std::uint32_t value_type;  // Type of MW and PDB (MPCSR_VALUE_INT64 or MPCSR_VALUE_DOUBLE)
+    std::uint32_t reserved;
+    std::uint64_t num_graphs;
+    std::uint64_t table_offset;  // Offset of the uint64_t record offsets (one per graph)
+    std::uint64_t num_strings;
+    std::uint64_t strings_offset;  // Offset of the uint64_t string offsets (one per string), followed by the chars
+    std::uint8_t padding[8];
+};
+
+
+struct MappedGraphHeader {
+    std::uint32_t num_acc;
+    std::uint32_t N;
+    std::uint32_t E;
+    std::uint32_t PDB;
+    std::uint32_t num_variant_edges;  // Edges with variants (VC != 0)
+    std::uint32_t reserved;
+    std::uint64_t record_size;
+
+    std::uint64_t accessions;  // num_acc many '\0'-terminated strings
+    std::uint64_t nodes;
+    std::uint64_t edges;
+    std::uint64_t sequence_str_index;
+    std::uint64_t position;
+    std::uint64_t iso_index;
+    std::uint64_t iso_position;
+    std::uint64_t mono_weight;
+    std::uint64_t cleaved;
+    std::uint64_t qualifiers_str_index;
+    std::uint64_t variant_count;
+    std::uint64_t pdb_offsets;
+    std::uint64_t pdbs;
+};
+
+
+static_assert(sizeof(MappedFileHeader) == MPCSR_ALIGNMENT, "MappedFileHeader has to fill exactly one alignment block");
+
+
+#endif
@@ -1,14 +1,24 @@
 #include "protein_graph.hpp"
+#include "byte_swap.hpp"
+#include "interval_overlap.hpp"
+#include "mapped_graph_format.hpp"
 
 #include <algorithm>
 #include <atomic>
+#include <bit>
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
 #include <fstream>
 #include <iostream>
+#include <iterator>
+#include <limits>
 #include <map>
+#include <numeric>
+#include <stdexcept>
 #include <string>
+#include <tuple>
+#include <type_traits>
 #include <unordered_map>
 //DEBUG and time measurement
 #include <inttypes.h>
@@ -16,13 +26,207 @@
 
 #include <ulimit.h>
 
+#define PDB_UNMERGED (double)INT64_MAX  // Open bound, marks the intervals of a node as not merged
+
+// Sorts and merges the intervals of each node (up to its first open interval, no later one was ever looked at)
+// into merged. offsets (N+1) receives the beginning of the intervals of each node. A node with an interval, whose
+// lower bound is above its upper bound, cannot be merged: it keeps its intervals as they are, behind the marker
+// [PDB_UNMERGED, PDB_UNMERGED] (see overlapping_interval).
+template<class T>
+static void merge_intervals(const T* values, std::uint32_t num_n, std::uint32_t num_pdbs, std::uint32_t* offsets, T open, std::vector<T>& merged) {
+    std::vector<std::pair<T, T>> intervals;
+    bool inverted;
+    merged.clear();
+    for (std::size_t n = 0; n < num_n; n++) {
+        intervals.clear();
+        inverted = false;
+        for (std::size_t i = n * 2 * num_pdbs; i < (n + 1) * 2 * num_pdbs && values[i] != open; i += 2) {
+            inverted |= values[i] > values[i + 1];
+            intervals.push_back({values[i], values[i + 1]});
+        }
+
+        offsets[n] = merged.size();
+        if (inverted) {
+            merged.insert(merged.end(), {open, open});
+            for (auto const& [lower, upper] : intervals) {
+                merged.insert(merged.end(), {lower, upper});
+            }
+            continue;
+        }
+        std::sort(intervals.begin(), intervals.end());
+        for (auto const& [lower, upper] : intervals) {
+            if (merged.size() != offsets[n] && lower <= merged.back()) {
+                merged.back() = std::max(merged.back(), upper);  // Overlaps the previous interval
+            } else {
+                merged.insert(merged.end(), {lower, upper});
+            }
+        }
+    }
+    offsets[num_n] = merged.size();
+}
+
+// Whether no remaining mass (lower bound of the PDB intervals) of a graph is negative
+template<class T>
+static bool non_negative_bounds(const T* pdbs, const std::uint32_t* pdb_offsets, std::uint32_t num_n) {
+    for (std::size_t i = 0; i < pdb_offsets[num_n]; i += 2) {
+        if (pdbs[i] < 0) {return false;}
+    }
+    return true;
+}
+
+// Sorts the outgoing edges of each node by the mass of their targets (stable), together with their attributes
+// (CL, QU and VC, if loaded). Only done if the remaining masses are never negative (see non_negative_bounds), then
+// the traversals can stop at the first edge whose target overshoots the query (edges_sorted).
+void ProteinGraph::sort_edges() {
+    std::vector<std::uint32_t> order, buffer;
+    auto lighter = [this](std::uint32_t a, std::uint32_t b) { return this->mono_weight[a] < this->mono_weight[b]; };
+    for (uint32_t i = 0; i < this->N; i++) {
+        std::uint32_t e_b = (i == 0) ? 0 : this->nodes[i - 1], e_e = this->nodes[i];
+        if (std::is_sorted(this->edges + e_b, this->edges + e_e, lighter)) {continue;}
+
+        order.resize(e_e - e_b);
+        std::iota(order.begin(), order.end(), e_b);
+        std::stable_sort(order.begin(), order.end(), [&](std::uint32_t a, std::uint32_t b) { return lighter(this->edges[a], this->edges[b]); });
+        auto permute = [&](auto* column) {
+            if (column == nullptr) {return;}
+            buffer.assign(column + e_b, column + e_e);
+            for (std::size_t k = 0; k < order.size(); k++) {
+                column[e_b + k] = buffer[order[k] - e_b];
+            }
+        };
+        permute(this->edges);
+        permute(this->cleaved);
+        permute(this->qualifiers_str_index);
+        permute(this->variant_count);
+    }
+}
+
+// Removes the nodes and edges, which are on no path (from the start to the end node) of at most max_mass. No query
+// up to max_mass can report them, but the traversals would still expand them. The remaining nodes keep their (top)
+// order, hence the paths are reported as before. A mapped graph is copied into its own arena, if anything is removed.
+void ProteinGraph::prune(std::int64_t max_mass) {
+    const double unreachable = std::numeric_limits<double>::infinity();
+    const double limit = (double) max_mass * (1 + 1e-9);  // Rounding (the masses are summed in another order than by the traversals)
+    auto edges_of = [this](std::uint32_t i) { return std::make_pair((i == 0) ? 0 : this->nodes[i - 1], this->nodes[i]); };
+
+    // Lightest mass of a path from the start node to each node (including it) and from each node (excluding it) to the end node
+    std::vector<double> prefix(this->N, unreachable), suffix(this->N, unreachable);
+    prefix[0] = 0;
+    for (std::uint32_t i = 0; i + 1 < this->N; i++) {
+        if (prefix[i] == unreachable) {continue;}
+        auto [e_b, e_e] = edges_of(i);
+        for (std::uint32_t k = e_b; k < e_e; k++) {
+            prefix[this->edges[k]] = std::min(prefix[this->edges[k]], prefix[i] + this->mono_weight[this->edges[k]]);
+        }
+    }
+    suffix[this->N - 1] = 0;
+    for (std::uint32_t i = this->N - 1; i-- > 0;) {
+        auto [e_b, e_e] = edges_of(i);
+        for (std::uint32_t k = e_b; k < e_e; k++) {
+            if (suffix[this->edges[k]] == unreachable) {continue;}
+            suffix[i] = std::min(suffix[i], this->mono_weight[this->edges[k]] + suffix[this->edges[k]]);
+        }
+    }
+
+    // An edge is kept, if the lightest path over it is light enough. Its nodes are then kept as well (start and end always)
+    std::vector<char> kept_edge(this->E, 0);
+    std::vector<std::uint32_t> new_id(this->N, UINT32_MAX);
+    std::uint32_t num_n = 0, num_e = 0;
+    for (std::uint32_t i = 0; i < this->N; i++) {
+        if (i == 0 || i == this->N - 1 || (prefix[i] != unreachable && suffix[i] != unreachable && prefix[i] + suffix[i] <= limit)) {
+            new_id[i] = num_n++;
+        }
+        if (prefix[i] == unreachable || i == this->N - 1) {continue;}
+        auto [e_b, e_e] = edges_of(i);
+        for (std::uint32_t k = e_b; k < e_e; k++) {
+            std::uint32_t target = this->edges[k];
+            kept_edge[k] = suffix[target] != unreachable && prefix[i] + this->mono_weight[target] + suffix[target] <= limit;
+            num_e += kept_edge[k];
+        }
+    }
+    if (num_n == this->N && num_e == this->E) {return;}
+
+    // Compact the (loaded) columns into a new arena
+    std::size_t num_bounds = 0;
+    for (std::uint32_t i = 0; i < this->N; i++) {
+        if (new_id[i] != UINT32_MAX) { num_bounds += this->pdb_offsets[i + 1] - this->pdb_offsets[i]; }
+    }
+    std::size_t arena_size = ColumnArena::aligned<std::uint32_t>(num_n) + ColumnArena::aligned<std::uint32_t>(num_e)
+        + ColumnArena::aligned<double>(num_n) + ColumnArena::aligned<std::uint8_t>(num_e)
+        + ColumnArena::aligned<std::uint32_t>((std::size_t) num_n + 1);  // NO, ED, MW, VC and the PDB-offsets
+    if (this->sequence_str_index != nullptr) { arena_size += ColumnArena::aligned<std::uint32_t>(num_n); }
+    if (this->position != nullptr) { arena_size += ColumnArena::aligned<std::uint16_t>(num_n) * 2 + ColumnArena::aligned<std::uint8_t>(num_n); }
+    if (this->cleaved != nullptr) { arena_size += ColumnArena::aligned<std::uint8_t>(num_e); }
+    if (this->qualifiers_str_index != nullptr) { arena_size += ColumnArena::aligned<std::uint32_t>(num_e); }
+    ColumnArena arena(arena_size);
+    ColumnArena pdb_arena(ColumnArena::aligned<double>(num_bounds));
+
+    auto compact = [&](auto* column, std::uint32_t num, auto&& kept) {
+        using Entry = std::remove_pointer_t<decltype(column)>;
+        if (column == nullptr) {return (Entry*) nullptr;}
+        Entry* compacted = arena.carve<Entry>(num);
+        for (std::uint32_t i = 0, j = 0; j < num; i++) {
+            if (kept(i)) { compacted[j++] = column[i]; }
+        }
+        return compacted;
+    };
+    auto kept_node = [&](std::uint32_t i) { return new_id[i] != UINT32_MAX; };
+    auto kept_in = [&](std::uint32_t k) { return kept_edge[k] != 0; };
+
+    std::uint32_t* nodes = arena.carve<std::uint32_t>(num_n);
+    for (std::uint32_t i = 0, edges_before = 0; i < this->N; i++) {
+        auto [e_b, e_e] = edges_of(i);
+        edges_before += std::count(kept_edge.begin() + e_b, kept_edge.begin() + e_e, 1);
+        if (kept_node(i)) { nodes[new_id[i]] = edges_before; }
+    }
+    std::uint32_t* edges = compact(this->edges, num_e, kept_in);
+    for (std::uint32_t k = 0; k < num_e; k++) {
+        edges[k] = new_id[edges[k]];
+    }
+    std::uint32_t* sequence_str_index = compact(this->sequence_str_index, num_n, kept_node);
+    std::uint16_t* position = compact(this->position, num_n, kept_node);
+    std::uint8_t* iso_index = compact(this->iso_index, num_n, kept_node);
+    std::uint16_t* iso_position = compact(this->iso_position, num_n, kept_node);
+    double* mono_weight = compact(this->mono_weight, num_n, kept_node);
+    std::uint8_t* cleaved = compact(this->cleaved, num_e, kept_in);
+    std::uint32_t* qualifiers_str_index = compact(this->qualifiers_str_index, num_e, kept_in);
+    std::uint8_t* variant_count = compact(this->variant_count, num_e, kept_in);
+
+    std::uint32_t* pdb_offsets = arena.carve<std::uint32_t>((std::size_t) num_n + 1);
+    double* pdbs = pdb_arena.carve<double>(num_bounds);
+    pdb_offsets[0] = 0;
+    for (std::uint32_t i = 0; i < this->N; i++) {
+        if (!kept_node(i)) {continue;}
+        double* end = std::copy(this->pdbs + this->pdb_offsets[i], this->pdbs + this->pdb_offsets[i + 1], pdbs + pdb_offsets[new_id[i]]);
+        pdb_offsets[new_id[i] + 1] = end - pdbs;
+    }
+
+    // Switch to the pruned columns (the old ones are freed with their arena or mapping)
+    this->N = num_n;
+    this->E = num_e;
+    this->nodes = nodes;
+    this->edges = edges;
+    this->sequence_str_index = sequence_str_index;
+    this->position = position;
+    this->iso_index = iso_index;
+    this->iso_position = iso_position;
+    this->mono_weight = mono_weight;
+    this->cleaved = cleaved;
+    this->qualifiers_str_index = qualifiers_str_index;
+    this->variant_count = variant_count;
+    this->num_variant_edges = num_e - std::count(variant_count, variant_count + num_e, 0);
+    this->pdb_offsets = pdb_offsets;
+    this->pdbs = pdbs;
+    this->arena = std::move(arena);
+    this->pdb_arena = std::move(pdb_arena);
+    this->mapping.reset();
+}
+
 // Constructor
-ProteinGraph::ProteinGraph(std::uint32_t num_acc, std::ifstream &input, std::unordered_map<std::string, std::vector<uint8_t>> max_vars) {
-    uint32_t num_n, num_e, num_pdbs, cur_32bit;
-    uint8_t cur_8bit;
-    uint16_t cur_16bit;
-    uint64_t cur_64bit;
+ProteinGraph::ProteinGraph(std::uint32_t num_acc, std::istream &input, std::shared_ptr<StringPool> strings, const std::unordered_map<std::string, std::vector<uint8_t>>& max_vars, std::uint32_t columns) {
+    uint32_t num_n, num_e, num_pdbs;
     std::string cur_string;
+    const std::streamsize until_end = std::numeric_limits<std::streamsize>::max();
 
     // Get next entry and its global information about the entry
     num_acc = be32toh(num_acc);
@@ -35,147 +239,197 @@ ProteinGraph::ProteinGraph(std::uint32_t num_acc, std::ifstream &input, std::uno
     this->E = num_e;
     this->PDB = num_pdbs;
 
-    // Read AC
+    // Read AC (only the first one, if the others are not requested)
     for (int i = 0; i < num_acc; i++) {
-        std::getline(input, cur_string, '\0');
-        this->accessions.push_back(cur_string);
+        if (i == 0 || (columns & COLUMN_ACCESSIONS)) {
+            std::getline(input, cur_string, '\0');
+            this->accessions.push_back(cur_string);
+        } else {
+            input.ignore(until_end, '\0');
+        }
     }
 
-    // Read NO
-    this->nodes = new uint32_t[this->N];
-    for (int i = 0; i < num_n; i++) {
-        input.read((char*) &cur_32bit, 4); cur_32bit = be32toh(cur_32bit);
-        this->nodes[i] = cur_32bit;
-    }
+    // Allocate all (requested) numeric columns at once
+    std::size_t arena_size = ColumnArena::aligned<std::uint32_t>(num_n) + ColumnArena::aligned<std::uint32_t>(num_e)
+        + ColumnArena::aligned<double>(num_n) + ColumnArena::aligned<std::uint8_t>(num_e)
+        + ColumnArena::aligned<std::uint32_t>((std::size_t) num_n + 1);  // NO, ED, MW, VC and the PDB-offsets
+    if (columns & COLUMN_SEQUENCES) { arena_size += ColumnArena::aligned<std::uint32_t>(num_n); }
+    if (columns & COLUMN_POSITIONS) { arena_size += ColumnArena::aligned<std::uint16_t>(num_n) * 2 + ColumnArena::aligned<std::uint8_t>(num_n); }
+    if (columns & COLUMN_CLEAVED) { arena_size += ColumnArena::aligned<std::uint8_t>(num_e); }
+    if (columns & COLUMN_QUALIFIERS) { arena_size += ColumnArena::aligned<std::uint32_t>(num_e); }
+    this->arena = ColumnArena(arena_size);
 
-    // Read ED
-    this->edges = new uint32_t[this->E];
-    for (int i = 0; i < num_e; i++) {
-        input.read((char*) &cur_32bit, 4); cur_32bit = be32toh(cur_32bit);
-        this->edges[i] = cur_32bit;
-    }
+    // Read NO (numeric columns are read at once and converted in place)
+    this->nodes = this->arena.carve<std::uint32_t>(this->N);
+    input.read((char*) this->nodes, (std::streamsize) num_n * 4);
+    be_to_host_column<4>(this->nodes, num_n);
 
-    // Read SQ
-    // Get mapping first
-    std::unordered_map<std::string, std::vector<uint32_t>> seq_map;
-    for (int i = 0; i < num_n; i++) {
-        std::getline(input, cur_string, '\0');
-        seq_map[cur_string].push_back(i);
-    }
-    
-    cur_32bit = 0;
-    for (auto const& [key, val] : seq_map) {
-        cur_32bit += key.length() + 1; //? Chararray length
-    }
+    // Read ED
+    this->edges = this->arena.carve<std::uint32_t>(this->E);
+    input.read((char*) this->edges, (std::streamsize) num_e * 4);
+    be_to_host_column<4>(this->edges, num_e);
 
-    // Initialize via map
-    this->sequence_str = new char[cur_32bit];
-    cur_32bit = 0;
-    this->sequence_str_index = new std::uint32_t[this->N];
-    for (auto const& [key, val] : seq_map) {
-        std::strcpy(&this->sequence_str[cur_32bit], key.c_str());
-        // Now go through each entry in vector
-        for (uint32_t node_idx: val) {
-            this->sequence_str_index[node_idx] = cur_32bit;
+    // Read SQ (into the shared string pool)
+    this->strings = strings;
+    if (columns & COLUMN_SEQUENCES) {
+        this->sequence_str_index = this->arena.carve<std::uint32_t>(this->N);
+        for (int i = 0; i < num_n; i++) {
+            std::getline(input, cur_string, '\0');
+            this->sequence_str_index[i] = this->strings->intern(cur_string);
         }
-        cur_32bit += key.length() + 1;
-        this->sequence_str[cur_32bit - 1] = 0;        
+    } else {
+        for (int i = 0; i < num_n; i++) { input.ignore(until_end, '\0'); }
     }
 
-    // Read PO
-    this->position = new uint16_t[this->N];
-    for (int i = 0; i < num_n; i++) {
-        input.read((char*) &cur_16bit, 2); cur_16bit = be16toh(cur_16bit);
-        this->position[i] = cur_16bit;
-    }
-    
-    // Read IS
-    this->iso_index = new uint8_t[this->N];
-    for (int i = 0; i < num_n; i++) {
-        input.read((char*) &cur_8bit, 1);
-        this->iso_index[i] = cur_8bit;
-    }
+    // Read PO, IS and IP
+    if (columns & COLUMN_POSITIONS) {
+        this->position = this->arena.carve<std::uint16_t>(this->N);
+        input.read((char*) this->position, (std::streamsize) num_n * 2);
+        be_to_host_column<2>(this->position, num_n);
 
-    // Read IP
-    this->iso_position = new uint16_t[this->N];
-    for (int i = 0; i < num_n; i++) {
-        input.read((char*) &cur_16bit, 2); cur_16bit = be16toh(cur_16bit);
-        this->iso_position[i] = cur_16bit;
+        this->iso_index = this->arena.carve<std::uint8_t>(this->N);
+        input.read((char*) this->iso_index, num_n);
+
+        this->iso_position = this->arena.carve<std::uint16_t>(this->N);
+        input.read((char*) this->iso_position, (std::streamsize) num_n * 2);
+        be_to_host_column<2>(this->iso_position, num_n);
+    } else {
+        input.seekg((std::uint64_t) num_n * (2 + 1 + 2), std::ios::cur);
     }
 
     // Read MW
-    this->mono_weight = new double[this->N];
+    this->mono_weight = this->arena.carve<double>(this->N);
+    input.read((char*) this->mono_weight, (std::streamsize) num_n * 8);
+    be_to_host_column<8>(this->mono_weight, num_n);
     for (int i = 0; i < num_n; i++) {
-        input.read((char*) &cur_64bit, 8); cur_64bit = be64toh(cur_64bit);
-        this->mono_weight[i] = (double)cur_64bit;
+        this->mono_weight[i] = (double) std::bit_cast<std::uint64_t>(this->mono_weight[i]);  // Stored as integers
     }
 
     // Read CL
-    this->cleaved = std::vector<bool>(E, false);
-    for (int i = 0; i < num_e; i++) {
-        input.read((char*) &cur_8bit, 1);
-        if (cur_8bit != 0) {
-            this->cleaved.at(i).flip();
+    if (columns & COLUMN_CLEAVED) {
+        this->cleaved = this->arena.carve<std::uint8_t>(this->E);
+        input.read((char*) this->cleaved, num_e);
+        for (int i = 0; i < num_e; i++) {
+            this->cleaved[i] = (this->cleaved[i] != 0);
         }
+    } else {
+        input.seekg(num_e, std::ios::cur);
     }
 
-    // Read QU
-    // Get mapping first
-    std::unordered_map<std::string, std::vector<uint32_t>> qu_map;
-    for (int i = 0; i < num_e; i++) {
-        std::getline(input, cur_string, '\0');
-        qu_map[cur_string].push_back(i);
+    // Read QU (into the shared string pool)
+    if (columns & COLUMN_QUALIFIERS) {
+        this->qualifiers_str_index = this->arena.carve<std::uint32_t>(this->E);
+        for (int i = 0; i < num_e; i++) {
+            std::getline(input, cur_string, '\0');
+            this->qualifiers_str_index[i] = this->strings->intern(cur_string);
+        }
+    } else {
+        for (int i = 0; i < num_e; i++) { input.ignore(until_end, '\0'); }
     }
 
-    cur_32bit = 0;
-    for (auto const& [key, val] : qu_map) {
-        cur_32bit += key.length() + 1; //? Chararray length
-    }
+    // Read VC
+    this->variant_count = this->arena.carve<std::uint8_t>(this->E);
+    input.read((char*) this->variant_count, num_e);
+    this->num_variant_edges = this->E - std::count(this->variant_count, this->variant_count + this->E, 0);
 
-    // Initialize via map
-    this->qualifiers_str = new char[cur_32bit];
-    cur_32bit = 0;
-    this->qualifiers_str_index = new std::uint32_t[this->E];
-    for (auto const& [key, val] : qu_map) {
-        std::strcpy(&this->qualifiers_str[cur_32bit], key.c_str());
-        // Now go through each entry in vector
-        for (uint32_t edge_idx: val) {
-            this->qualifiers_str_index[edge_idx] = cur_32bit;
+    // Read PDBs (into a buffer, since only the merged intervals are kept)
+    static thread_local std::vector<double> raw_pdbs, merged_pdbs;
+    raw_pdbs.resize((std::size_t) num_n * 2 * num_pdbs);
+    input.read((char*) raw_pdbs.data(), (std::streamsize) num_n * 2 * num_pdbs * 8);
+    be_to_host_column<8>(raw_pdbs.data(), raw_pdbs.size());
+    for (std::size_t i = 0; i < raw_pdbs.size(); i++) {
+        std::uint64_t cur_64bit = std::bit_cast<std::uint64_t>(raw_pdbs[i]);
+        if (cur_64bit != uint64_t(-1)) {
+            raw_pdbs[i] = (double)cur_64bit;
+        } else {
+            raw_pdbs[i] = (double)INT64_MAX;
         }
-        cur_32bit += key.length() + 1;
-        this->qualifiers_str[cur_32bit - 1] = 0;        
     }
+    this->pdb_offsets = this->arena.carve<std::uint32_t>((std::size_t) num_n + 1);
+    merge_intervals<double>(raw_pdbs.data(), num_n, num_pdbs, this->pdb_offsets, PDB_UNMERGED, merged_pdbs);
+    std::size_t num_bounds = merged_pdbs.size();
+    this->pdb_arena = ColumnArena(ColumnArena::aligned<double>(num_bounds));
+    this->pdbs = this->pdb_arena.carve<double>(num_bounds);
+    std::copy(merged_pdbs.begin(), merged_pdbs.end(), this->pdbs);
 
-    // Read VC
-    this->variant_count = new std::uint8_t[this->E];
-    for (int i = 0; i < num_e; i++) {
-        input.read((char*) &cur_8bit, 1);
-        this->variant_count[i] = cur_8bit;
-    }
-
-    // Read PDBs (sequentially in RAM)
-    this->pdbs = new double[this->N*2*this->PDB];
-    for (int i=0; i<num_n; i++) {
-        for (int j=0; j<2*num_pdbs; j++) {
-            input.read((char*) &cur_64bit, 8); cur_64bit = be64toh(cur_64bit);
-            if (cur_64bit != uint64_t(-1)) {
-                this->pdbs[i*2*num_pdbs + j] = (double)cur_64bit;
-            } else {
-                this->pdbs[i*2*num_pdbs + j] = (double)INT64_MAX;
-            }
-        }
+    // Sort the edges of each node by the mass of their targets
+    this->edges_sorted = non_negative_bounds(this->pdbs, this->pdb_offsets, this->N);
+    if (this->edges_sorted) {
+        this->sort_edges();
     }
-    
+
     // Lastly Read max_vars into the proteingraph
-    this->max_vars_bins = new std::uint8_t[max_vars[this->accessions[0]].size()];
-    this->num_bins = max_vars[this->accessions[0]].size();
-    for (int i=0; i < this->num_bins; i++) {
-        this->max_vars_bins[i] = max_vars[this->accessions[0]].at(i);
+    this->set_max_vars(max_vars);
+
+}
+
+
+
+// Constructor (Mapped), the columns point directly into the record of the mapping
+ProteinGraph::ProteinGraph(const char* record, std::shared_ptr<const char> mapping, std::shared_ptr<StringPool> strings, const std::unordered_map<std::string, std::vector<uint8_t>>& max_vars, std::uint32_t columns) {
+    const MappedGraphHeader* header = (const MappedGraphHeader*) record;
+    this->mapping = mapping;
+    this->strings = strings;
+
+    // Set the most important Protein-Graph-Parameters
+    this->N = header->N;
+    this->E = header->E;
+    this->PDB = header->PDB;
+    this->num_variant_edges = header->num_variant_edges;
+
+    // Read AC (these are the only ones which are copied, only the first one if the others are not requested)
+    const char* cur_acc = record + header->accessions;
+    for (std::uint32_t i = 0; i < ((columns & COLUMN_ACCESSIONS) ? header->num_acc : std::min<std::uint32_t>(header->num_acc, 1)); i++) {
+        this->accessions.push_back(std::string(cur_acc));
+        cur_acc += this->accessions.back().length() + 1;
+    }
+
+    // Set the (requested) columns
+    this->nodes = (std::uint32_t*) (record + header->nodes);
+    this->edges = (std::uint32_t*) (record + header->edges);
+    this->mono_weight = (double*) (record + header->mono_weight);
+    if (columns & COLUMN_SEQUENCES) {
+        this->sequence_str_index = (std::uint32_t*) (record + header->sequence_str_index);
+    }
+    if (columns & COLUMN_POSITIONS) {
+        this->position = (std::uint16_t*) (record + header->position);
+        this->iso_index = (std::uint8_t*) (record + header->iso_index);
+        this->iso_position = (std::uint16_t*) (record + header->iso_position);
+    }
+    if (columns & COLUMN_CLEAVED) {
+        this->cleaved = (std::uint8_t*) (record + header->cleaved);
     }
+    if (columns & COLUMN_QUALIFIERS) {
+        this->qualifiers_str_index = (std::uint32_t*) (record + header->qualifiers_str_index);
+    }
+    this->variant_count = (std::uint8_t*) (record + header->variant_count);
+    this->pdb_offsets = (std::uint32_t*) (record + header->pdb_offsets);
+    this->pdbs = (double*) (record + header->pdbs);
+    this->edges_sorted = non_negative_bounds(this->pdbs, this->pdb_offsets, this->N);  // As sorted by the converter
+
+    // Lastly Read max_vars into the proteingraph
+    this->set_max_vars(max_vars);
+}
+
 
+// Sets the variant limits of this protein (no limits are set, if the protein is not listed)
+void ProteinGraph::set_max_vars(const std::unordered_map<std::string, std::vector<uint8_t>>& max_vars) {
+    auto limits = max_vars.find(this->accessions[0]);
+    this->num_bins = (limits != max_vars.end()) ? limits->second.size() : 0;
+    this->max_vars_bins.clear();
+    if (this->num_bins != 0) {
+        this->max_vars_bins = limits->second;
+    }
 }
 
 
+// Estimated cost of traversing the graph (in arbitrary units, to order the graphs by): its nodes, edges and PDB
+// intervals, weighted by its variant edges, since each of them adds alternative paths. Only the counts of the graph
+// are used (no column is read), 0 if not loaded (lazy).
+double ProteinGraph::estimated_cost() const {
+    double size = (double) this->N + this->E + (double) this->N * this->PDB;
+    return size * (1 + this->num_variant_edges);
+}
 
 // Gets the edge from the source and target node. NOTE: the edge should exist, otherwise it returns 0!
 uint32_t ProteinGraph::get_edge_index(uint32_t source_node, uint32_t target_node) {
@@ -214,7 +468,7 @@ std::string ProteinGraph::convert_paths_to_fasta(std::vector<std::vector<uint32_
 
         // Get sequence, spos, mssclvg, iso_idx and qualifiers
         for (uint32_t idx = 1; idx < path.size()-1; idx++) {
-            sequence_intermediate = std::string(&this->sequence_str[this->sequence_str_index[path.at(idx)]]);
+            sequence_intermediate = std::string(this->sequence(path.at(idx)));
             sequence.append(sequence_intermediate);  // concat sequences
             iso_idx = std::max(this->iso_index[path.at(idx)], iso_idx); // get the accession (maybe iso accession)
 
@@ -233,32 +487,32 @@ std::string ProteinGraph::convert_paths_to_fasta(std::vector<std::vector<uint32_
             
             // We need to look up via the specific edge index!!!
             cur_edge_id = get_edge_index(path.at(idx-1), path.at(idx));
-            if (this->cleaved.at(cur_edge_id)) {
+            if (this->cleaved[cur_edge_id]) {
                 mssclvg++; // count misscleavages
             }
             // We need to look up via the specific edge index!!!
-            if (std::string(&this->qualifiers_str[this->qualifiers_str_index[cur_edge_id]]).length() > 0) {
-                qualifiers.append(std::string(&this->qualifiers_str[this->qualifiers_str_index[cur_edge_id]]));
+            if (std::string(this->qualifiers(cur_edge_id)).length() > 0) {
+                qualifiers.append(std::string(this->qualifiers(cur_edge_id)));
                 qualifiers.append(",");
             }
             tot_weight += this->mono_weight[path.at(idx)]; // Only a Sanity Check!!!
         }
         // Edge Case, there might by a qualifier to the end node
         cur_edge_id = get_edge_index(path.at(path.size()-2), path.at(path.size()-1));
-        if (std::string(&this->qualifiers_str[this->qualifiers_str_index[cur_edge_id]]).length() > 0) {
-                qualifiers.append(std::string(&this->qualifiers_str[this->qualifiers_str_index[cur_edge_id]]));
+        if (std::string(this->qualifiers(cur_edge_id)).length() > 0) {
+                qualifiers.append(std::string(this->qualifiers(cur_edge_id)));
                 qualifiers.append(",");
             }
 
         // Get epos
         for (uint32_t idx = path.size()-2; idx > 0; idx--) {
-            sequence_intermediate = std::string(&this->sequence_str[this->sequence_str_index[path.at(idx)]]);
+            sequence_intermediate = std::string(this->sequence(path.at(idx)));
             if (0 != sequence_intermediate.compare("")) {
                 // Retrieve ending pos
                 if (this->iso_position[path.at(idx)] != UINT16_MAX){
-                    epos = std::to_string(this->iso_position[path.at(idx)] + std::string(&this->sequence_str[this->sequence_str_index[path.at(idx)]]).length() -1);
+                    epos = std::to_string(this->iso_position[path.at(idx)] + std::string(this->sequence(path.at(idx))).length() -1);
                 } else if (this->position[path.at(idx)] != UINT16_MAX) {
-                    epos = std::to_string(this->position[path.at(idx)] + std::string(&this->sequence_str[this->sequence_str_index[path.at(idx)]]).length() -1);
+                    epos = std::to_string(this->position[path.at(idx)] + std::string(this->sequence(path.at(idx))).length() -1);
                 } else {
                     epos = '?';
                 }
@@ -285,23 +539,46 @@ std::string ProteinGraph::convert_paths_to_fasta(std::vector<std::vector<uint32_
 }
 
 
+#define PDB_SCAN_LIMIT 16  // Nodes with up to this many bounds are scanned at once, the intervals of others are binary searched
+
 bool ProteinGraph::overlapping_interval(uint32_t node_num, double lower, double upper) {
-    uint32_t pdb_n = 2*this->PDB;
-    double pdb_lower, pdb_upper;
-
-    // Iterate over all pdb entries 
-    for (uint32_t i = 0; i < pdb_n; i+=2) {
-        pdb_lower = pdbs[node_num*pdb_n  + i];
-        // As long as an interval is specified
-        if ((double)INT64_MAX == pdb_lower) { break; }  // No more intervals to look into!
-
-        // Check if it is overlapping!
-        pdb_upper = this->pdbs[node_num*pdb_n  + i + 1];
-        if (
-            pdb_lower <= (double)upper
-            &&
-            pdb_upper >= (double)lower
-        ) {
+    const double* intervals = this->pdbs + this->pdb_offsets[node_num];
+    std::size_t num = this->pdb_offsets[node_num + 1] - this->pdb_offsets[node_num];
+
+    // Intervals which are not merged (see merge_intervals) are tested one by one, like the merged ones if there are few
+    if (num > 0 && intervals[0] == PDB_UNMERGED) {
+        return overlapping_intervals(intervals + 2, num - 2, lower, upper);
+    }
+    if (num <= PDB_SCAN_LIMIT) {
+        return overlapping_intervals(intervals, num, lower, upper);
+    }
+
+    // Else find the first interval ending at or above lower (the merged intervals are sorted and disjoint)
+    std::size_t first = 0, count = num / 2, step;
+    while (count > 0) {
+        step = count / 2;
+        if (intervals[2 * (first + step) + 1] < lower) {
+            first += step + 1;
+            count -= step + 1;
+        } else {
+            count = step;
+        }
+    }
+    return first < num / 2 && intervals[2 * first] <= upper;
+};
+
+// Same as overlapping_interval for a batch of windows (disjoint and sorted), shifted by achieved. Per interval of
+// the node only the first window ending above it can overlap, which is found by binary search.
+bool ProteinGraph::overlapping_windows(uint32_t node_num, const std::vector<std::tuple<double, double>>& windows, double achieved) {
+    const double* intervals = this->pdbs + this->pdb_offsets[node_num];
+    std::size_t num = this->pdb_offsets[node_num + 1] - this->pdb_offsets[node_num];
+
+    // Iterate over all (merged) intervals of the node
+    for (std::size_t i = 0; i < num; i += 2) {
+        auto window = std::lower_bound(windows.begin(), windows.end(), intervals[i],
+            [achieved](const std::tuple<double, double>& window, double value) { return std::get<1>(window) - achieved < value; }
+        );
+        if (window != windows.end() && std::get<0>(*window) - achieved <= intervals[i + 1]) {
             return true;
         }
     }
@@ -309,23 +586,294 @@ bool ProteinGraph::overlapping_interval(uint32_t node_num, double lower, double
     return false;
 };
 
+#define FRONTIER_SCAN_LIMIT 64  // Nodes with up to this many partial paths test them one by one (and are not sorted)
+
+// Ranges of the partial paths of a node (sorted by their weight, see FRONTIER_SCAN_LIMIT), which are accepted by overlapping_interval
+// when extended by weight to node_num. A path passes an interval if lower - achieved <= its upper bound and
+// upper - achieved >= its lower bound, hence the paths passing an interval are found by two binary searches
+// (instead of testing each path). The ranges are sorted and disjoint.
+void ProteinGraph::accepted_ranges(uint32_t node_num, const std::vector<double>& tv_vals, double weight, double lower, double upper, std::vector<std::pair<std::size_t, std::size_t>>& ranges) {
+    const double* intervals = this->pdbs + this->pdb_offsets[node_num];
+    std::size_t num = this->pdb_offsets[node_num + 1] - this->pdb_offsets[node_num];
+    std::size_t begin, end;
+    ranges.clear();
+
+    // Few partial paths or intervals which are not merged: test each of them
+    if (tv_vals.size() <= FRONTIER_SCAN_LIMIT || (num > 0 && intervals[0] == PDB_UNMERGED)) {
+        for (std::size_t j = 0; j < tv_vals.size(); j++) {
+            if (!this->overlapping_interval(node_num, lower - (tv_vals[j] + weight), upper - (tv_vals[j] + weight))) {continue;}
+            if (!ranges.empty() && ranges.back().second == j) {
+                ranges.back().second++;
+            } else {
+                ranges.push_back({j, j + 1});
+            }
+        }
+        return;
+    }
+
+    // The highest interval accepts the lightest paths, hence go from it downwards
+    for (std::size_t i = num; i >= 2; i -= 2) {
+        begin = std::partition_point(tv_vals.begin(), tv_vals.end(),
+            [&](double tv_val) { return lower - (tv_val + weight) > intervals[i - 1]; }
+        ) - tv_vals.begin();
+        end = std::partition_point(tv_vals.begin() + begin, tv_vals.end(),
+            [&](double tv_val) { return upper - (tv_val + weight) >= intervals[i - 2]; }
+        ) - tv_vals.begin();
+        if (begin >= end) {continue;}
+
+        // Windows spanning multiple intervals accept a path multiple times
+        if (!ranges.empty() && begin <= ranges.back().second) {
+            ranges.back().second = std::max(ranges.back().second, end);
+        } else {
+            ranges.push_back({begin, end});
+        }
+    }
+};
+
+// Per-node state of the traversals, indexed by the node id (instead of hash maps). Each thread keeps its own
+// and reuses it for all graphs and queries, hence the vectors mostly keep their capacity.
+#define SCRATCH_KEEP_CAPACITY 4096  // Larger vectors of a node are freed again once the node is expanded
+#define SCRATCH_KEEP_RECORDS (1 << 20)  // A larger arena of path records is freed again after the query
+
+// Step of a partial path: the path to parent (index into the arena) extended by node. Paths sharing a
+// prefix share its records, full paths are only built for the paths reaching the end node.
+struct PathRecord {
+    std::size_t parent;
+    uint32_t node;
+};
+#define PATH_ROOT SIZE_MAX  // Parent of the first record (start node)
+
+// Partial path reaching a node in tvs_traverse_merged: its weight, its variants and the (merged) state it extends
+struct MergedCandidate {
+    double tv_val;
+    uint8_t var_count;
+    std::size_t predecessor;  // Index into merged_states (PATH_ROOT for the start node)
+};
+
+// State of tvs_traverse_merged: all partial paths reaching node with the same weight and number of variants
+struct MergedState {
+    double tv_val;
+    uint8_t var_count;
+    uint32_t node;
+    std::size_t predecessors_begin, predecessors_end;  // Range in merged_predecessors
+    std::uint64_t num_paths;  // Number of partial paths merged into this state
+};
+
+// Order of the paths reaching the end node, as found by one traversal: paths were found by the node they came from and
+// then by the order of the path up to it, i.e. by their nodes compared from the end
+static bool found_before(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b) {
+    return std::lexicographical_compare(a.rbegin(), a.rend(), b.rbegin(), b.rend());
+}
+
+struct TraversalScratch {
+    std::vector<std::vector<double>> tv_vals;  // tv vals achieved and currently achieved by expanding
+    std::vector<std::vector<uint8_t>> var_count;  // Variants used to achieve the corresponding tv_val
+    std::vector<std::vector<std::size_t>> paths;  // Paths (last record in path_records) which were taken to achieve the corresponding tv_val
+    std::vector<PathRecord> path_records;  // Arena of the partial paths of the current query
+    std::vector<std::vector<MergedCandidate>> candidates;  // Partial paths reaching a node (tvs_traverse_merged)
+    std::vector<MergedState> merged_states;  // Arena of the states of the current query (tvs_traverse_merged)
+    std::vector<std::size_t> merged_predecessors;  // Predecessors of the merged states
+    std::vector<std::size_t> order;  // Permutation of the partial paths of a node (sort_by_weight)
+    std::vector<double> sorted_tv_vals;
+    std::vector<uint8_t> sorted_var_count;
+    std::vector<std::size_t> sorted_paths;
+    std::vector<std::pair<std::size_t, std::size_t>> ranges;  // Accepted partial paths of an edge (see accepted_ranges)
+
+    // Empty state for a graph with N nodes
+    void reset(uint32_t N) {
+        if (this->tv_vals.size() < N) {
+            this->tv_vals.resize(N);
+            this->var_count.resize(N);
+            this->paths.resize(N);
+            this->candidates.resize(N);
+        }
+        if (this->merged_states.capacity() > SCRATCH_KEEP_RECORDS) {
+            std::vector<MergedState>().swap(this->merged_states);
+            std::vector<std::size_t>().swap(this->merged_predecessors);
+        }
+        this->merged_states.clear();
+        this->merged_predecessors.clear();
+        if (this->path_records.capacity() > SCRATCH_KEEP_RECORDS) {
+            std::vector<PathRecord>().swap(this->path_records);
+        }
+        this->path_records.clear();
+        for (uint32_t i = 0; i < N; i++) {
+            this->release(i);
+        }
+    }
+
+    // Drops the state of an expanded node
+    void release(uint32_t i) {
+        if (this->tv_vals[i].capacity() > SCRATCH_KEEP_CAPACITY) {
+            std::vector<double>().swap(this->tv_vals[i]);
+            std::vector<uint8_t>().swap(this->var_count[i]);
+            std::vector<std::size_t>().swap(this->paths[i]);
+        } else {
+            this->tv_vals[i].clear();
+            this->var_count[i].clear();
+            this->paths[i].clear();
+        }
+        if (this->candidates[i].capacity() > SCRATCH_KEEP_CAPACITY) {
+            std::vector<MergedCandidate>().swap(this->candidates[i]);
+        } else {
+            this->candidates[i].clear();
+        }
+    }
+
+    // Sorts the partial paths of node i by their weight (stable, together with their variants and paths), unless
+    // accepted_ranges tests them one by one
+    void sort_by_weight(uint32_t i) {
+        std::vector<double>& vals = this->tv_vals[i];
+        if (vals.size() <= FRONTIER_SCAN_LIMIT || std::is_sorted(vals.begin(), vals.end())) {return;}
+        this->order.resize(vals.size());
+        std::iota(this->order.begin(), this->order.end(), 0);
+        std::stable_sort(this->order.begin(), this->order.end(), [&vals](std::size_t a, std::size_t b) { return vals[a] < vals[b]; });
+        permute(vals, this->sorted_tv_vals);
+        permute(this->paths[i], this->sorted_paths);
+        if (!this->var_count[i].empty()) {
+            permute(this->var_count[i], this->sorted_var_count);
+        }
+    }
+
+    // Reorders values by order (through sorted, which keeps the previous buffer of values)
+    template<typename V>
+    void permute(std::vector<V>& values, std::vector<V>& sorted) const {
+        sorted.clear();
+        for (std::size_t j : this->order) {
+            sorted.push_back(values[j]);
+        }
+        values.swap(sorted);
+    }
+
+    // Starts the path at the start node
+    std::size_t start_path() {
+        this->path_records.push_back({PATH_ROOT, 0});
+        return this->path_records.size() - 1;
+    }
+
+    // Extends a path by a node
+    std::size_t extend_path(std::size_t path, uint32_t node) {
+        this->path_records.push_back({path, node});
+        return this->path_records.size() - 1;
+    }
+
+    // Builds the full paths (node ids from the start node on) of the given records
+    std::vector<std::vector<uint32_t>> build_paths(const std::vector<std::size_t>& ends) const {
+        std::vector<std::vector<uint32_t>> full_paths(ends.size());
+        for (std::size_t p = 0; p < ends.size(); p++) {
+            for (std::size_t r = ends[p]; r != PATH_ROOT; r = this->path_records[r].parent) {
+                full_paths[p].push_back(this->path_records[r].node);
+            }
+            std::reverse(full_paths[p].begin(), full_paths[p].end());
+        }
+
+        // The sorted partial paths reach the end node in another order than they were found, restore it
+        std::sort(full_paths.begin(), full_paths.end(), found_before);
+        return full_paths;
+    }
+    // Merges the partial paths reaching node into states (same weight and number of variants), which are
+    // appended to merged_states. Returns the first of them.
+    std::size_t merge_candidates(uint32_t node) {
+        std::vector<MergedCandidate>& reaching = this->candidates[node];
+        std::stable_sort(reaching.begin(), reaching.end(), [](const MergedCandidate& a, const MergedCandidate& b) {
+            return a.tv_val < b.tv_val || (a.tv_val == b.tv_val && a.var_count < b.var_count);
+        });
+        std::size_t first_state = this->merged_states.size();
+        for (std::size_t c = 0; c < reaching.size(); c++) {
+            if (c == 0 || reaching[c].tv_val != reaching[c-1].tv_val || reaching[c].var_count != reaching[c-1].var_count) {
+                std::size_t begin = this->merged_predecessors.size();
+                this->merged_states.push_back({reaching[c].tv_val, reaching[c].var_count, node, begin, begin, 0});
+            }
+            MergedState& merged = this->merged_states.back();
+            merged.predecessors_end++;
+            this->merged_predecessors.push_back(reaching[c].predecessor);
+            merged.num_paths += (reaching[c].predecessor == PATH_ROOT) ? 1 : this->merged_states[reaching[c].predecessor].num_paths;
+        }
+        return first_state;
+    }
+
+    // Number of paths of the partial paths reaching a node (without unfolding them)
+    std::uint64_t count_paths(const std::vector<MergedCandidate>& ends) const {
+        std::uint64_t num_paths = 0;
+        for (const MergedCandidate& end : ends) {
+            num_paths += this->merged_states[end.predecessor].num_paths;
+        }
+        return num_paths;
+    }
+
+    // Builds the full paths (node ids from the start node on) of the partial paths reaching end_node
+    std::vector<std::vector<uint32_t>> unfold_paths(const std::vector<MergedCandidate>& ends, uint32_t end_node) const {
+        std::vector<std::vector<uint32_t>> full_paths;
+        std::vector<uint32_t> reversed_path = {end_node};
+        std::vector<std::pair<std::size_t, std::size_t>> stack;  // State and its next predecessor to visit
+        for (const MergedCandidate& end : ends) {
+            stack.push_back({end.predecessor, this->merged_states[end.predecessor].predecessors_begin});
+            reversed_path.push_back(this->merged_states[end.predecessor].node);
+            while (!stack.empty()) {
+                const MergedState& merged = this->merged_states[stack.back().first];
+                std::size_t& next = stack.back().second;
+                if (next == merged.predecessors_end) {
+                    stack.pop_back();
+                    reversed_path.pop_back();
+                    continue;
+                }
+                std::size_t predecessor = this->merged_predecessors[next++];
+                if (predecessor == PATH_ROOT) {
+                    full_paths.emplace_back(reversed_path.rbegin(), reversed_path.rend());
+                } else {
+                    stack.push_back({predecessor, this->merged_states[predecessor].predecessors_begin});
+                    reversed_path.push_back(this->merged_states[predecessor].node);
+                }
+            }
+        }
+
+        // The states are unfolded by weight, restore the order of the naive traversals (see build_paths)
+        std::sort(full_paths.begin(), full_paths.end(), found_before);
+        return full_paths;
+    }
+};
+
+static thread_local TraversalScratch traversal_scratch;
+
+
+// Merges the full paths of the parts of a traversal (see naive_paths), in the order of one traversal (see
+// TraversalScratch::build_paths)
+std::vector<std::vector<uint32_t>> ProteinGraph::merge_parts(std::vector<std::vector<std::vector<uint32_t>>>& part_paths) {
+    std::vector<std::vector<uint32_t>> full_paths = std::move(part_paths[0]);
+    if (part_paths.size() == 1) {return full_paths;}
+    for (std::size_t p = 1; p < part_paths.size(); p++) {
+        std::move(part_paths[p].begin(), part_paths[p].end(), std::back_inserter(full_paths));
+    }
+    std::sort(full_paths.begin(), full_paths.end(), found_before);
+    return full_paths;
+}
+
+
 /*------------------------------------------------------------------------------------------------------*/
 /*----------------------------------Float Implementation----------------------------------------------*/
 /*------------------------------------------------------------------------------------------------------*/
 std::string ProteinGraph::tvs_traverse_naive(int64_t lower, int64_t upper) {
+    return convert_paths_to_fasta(this->naive_paths(lower, upper, 0, 1));
+};
+
+// Part of tvs_traverse_naive: part p of parts only follows the paths over the start edges p, p + parts, p + 2 * parts,
+// ..., which share no partial path with the other parts. Hence the parts can run on several threads (each with its
+// own scratch), merge_parts merges their full paths.
+std::vector<std::vector<uint32_t>> ProteinGraph::naive_paths(int64_t lower, int64_t upper, std::uint32_t part, std::uint32_t parts) {
     
-    // State information
-    std::unordered_map<uint32_t, std::vector<double>> tv_vals;  // tv vals achieved and currently achieved by expanding
-    std::unordered_map<uint32_t, std::vector<std::vector<uint32_t>>> paths;  // Paths which was taken to achieve the corresponding tv_val
+    // State information (per node, see TraversalScratch)
+    TraversalScratch& state = traversal_scratch;
+    state.reset(this->N);
+    std::vector<std::vector<double>>& tv_vals = state.tv_vals;  // tv vals achieved and currently achieved by expanding
+    std::vector<std::vector<std::size_t>>& paths = state.paths;  // Paths which were taken to achieve the corresponding tv_val
     double f_lower = (double)lower, f_upper = (double)upper;  // Convert query to doubles
 
     // Variables during traversal
     uint32_t e_b, e_e, target_node;
-    double new_lower, new_upper, achieved;
 
     // Initial values for traversal
     tv_vals[0] = {0};
-    paths[0] = {{0}};
+    paths[0] = {state.start_path()};
 
     // For every node (in top order)
     for (uint32_t i = 0; i < this->N-1; i++) {
@@ -339,62 +887,256 @@ std::string ProteinGraph::tvs_traverse_naive(int64_t lower, int64_t upper) {
             e_b = this->nodes[i - 1]; e_e = this->nodes[i];
         }
         
-        // For every possible path
-        for (uint32_t j = 0; j < tv_vals[i].size(); j++) {   
+        // Sort the partial paths by their weight, the accepted ones of an edge are then ranges (see accepted_ranges)
+        state.sort_by_weight(i);
+        double lightest = *std::min_element(tv_vals[i].begin(), tv_vals[i].end());
+
+        // For every outgoing edge of the node
+        for (uint32_t k = e_b; k < e_e; k++) {
+            if (i == 0 && k % parts != part) {continue;}  // Start edge of another part (see naive_paths)
+            target_node = this->edges[k];  // Target of Edge
+            if (this->edges_sorted && lightest + this->mono_weight[target_node] > f_upper) {break;}  // Every path overshoots the query with this and all further edges (sorted by mass)
+            this->accepted_ranges(target_node, tv_vals[i], this->mono_weight[target_node], f_lower, f_upper, state.ranges);
+
+            // Expand all accepted paths (instead of checking each path)
+            for (auto const& [j_begin, j_end] : state.ranges) {
+                for (std::size_t j = j_begin; j < j_end; j++) {
+                    // Add new tv_val
+                    tv_vals[target_node].push_back(tv_vals[i][j] + this->mono_weight[target_node]);
+
+                    // Add new path how we achieved it
+                    paths[target_node].push_back(state.extend_path(paths[i][j], target_node));
+                }
+            }
+        }
+        
+        // Free memory during traversal, since older results can be removed (-> dag)!
+        state.release(i);
+    };
+
+    // Return results
+    return state.build_paths(paths[this->N-1]);
+};
+
+
+std::string ProteinGraph::tvs_traverse_varcount_naive(int64_t lower, int64_t upper, uint8_t max_vars) {
+    return convert_paths_to_fasta(this->varcount_paths(lower, upper, max_vars, 0, 1));
+};
+
+// Part of tvs_traverse_varcount_naive (see naive_paths)
+std::vector<std::vector<uint32_t>> ProteinGraph::varcount_paths(int64_t lower, int64_t upper, uint8_t max_vars, std::uint32_t part, std::uint32_t parts) {
+    
+    // State information (per node, see TraversalScratch)
+    TraversalScratch& state = traversal_scratch;
+    state.reset(this->N);
+    std::vector<std::vector<double>>& tv_vals = state.tv_vals;  // tv vals achieved and currently achieved by expanding
+    std::vector<std::vector<uint8_t>>& var_count = state.var_count;  // Variants used to achieve the corresponding tv_val
+    std::vector<std::vector<std::size_t>>& paths = state.paths;  // Paths which were taken to achieve the corresponding tv_val
+
+    double f_lower = (double)lower, f_upper = (double)upper;  // Convert query to doubles
+
+    // Variables during traversal
+    uint32_t e_b, e_e, target_node;
+    uint16_t current_var_count;
+
+    // Initial values for traversal
+    tv_vals[0] = {0};
+    var_count[0] = {0};
+    paths[0] = {state.start_path()};
+
+    // For every node (in top order)
+    for (uint32_t i = 0; i < this->N-1; i++) {
+        // skip if tv_vals is already empty (no paths!)
+        if (tv_vals[i].size() == 0) {continue;}
+
+        // Get beginning and ending of edge-ids
+        if (i == 0) {
+            e_b = 0; e_e = this->nodes[i];
+        } else {
+            e_b = this->nodes[i - 1]; e_e = this->nodes[i];
+        }
+        
+        // Sort the partial paths by their weight, the accepted ones of an edge are then ranges (see accepted_ranges)
+        state.sort_by_weight(i);
+        double lightest = *std::min_element(tv_vals[i].begin(), tv_vals[i].end());
+
+        // For every outgoing edge of the node
+        for (uint32_t k = e_b; k < e_e; k++) {
+            if (i == 0 && k % parts != part) {continue;}  // Start edge of another part (see naive_paths)
+            target_node = this->edges[k];  // Target of Edge
+            if (this->edges_sorted && lightest + this->mono_weight[target_node] > f_upper) {break;}  // Every path overshoots the query with this and all further edges (sorted by mass)
+            this->accepted_ranges(target_node, tv_vals[i], this->mono_weight[target_node], f_lower, f_upper, state.ranges);
+
+            // Expand all accepted paths (instead of checking each path)
+            for (auto const& [j_begin, j_end] : state.ranges) {
+                for (std::size_t j = j_begin; j < j_end; j++) {
+                    // Additionally count the variants
+                    current_var_count = var_count[i][j] + this->variant_count[k];
+                    if (current_var_count > max_vars) {continue;}
+
+                    // Add new tv_val
+                    tv_vals[target_node].push_back(tv_vals[i][j] + this->mono_weight[target_node]);
+
+                    // Count up used variants
+                    var_count[target_node].push_back(current_var_count);
+
+                    // Add new path how we achieved it
+                    paths[target_node].push_back(state.extend_path(paths[i][j], target_node));
+                }
+            }
+        }
+        
+        // Free memory during traversal, since older results can be removed (-> dag)!
+        state.release(i);
+    };
+
+    // Return results
+    return state.build_paths(paths[this->N-1]);
+};
+
+
+// Traversal merging the partial paths, which reach a node with the same weight and number of variants, into
+// one state with multiple predecessors. Each state is expanded once and the paths are only unfolded at the
+// end node, hence it finds the same paths as the naive traversals (sorted into their order, see unfold_paths).
+// max_vars == 255 --> Variants are not limited (as in tvs_traverse_naive)
+std::string ProteinGraph::tvs_traverse_merged(int64_t lower, int64_t upper, uint8_t max_vars) {
+
+    // State information (per node, see TraversalScratch)
+    TraversalScratch& state = traversal_scratch;
+    state.reset(this->N);
+    std::vector<std::vector<MergedCandidate>>& candidates = state.candidates;  // Partial paths reaching a node, merged when it is expanded
+    bool count_vars = max_vars != 255;
+
+    double f_lower = (double)lower, f_upper = (double)upper;  // Convert query to doubles
+
+    // Variables during traversal
+    uint32_t e_b, e_e, target_node;
+    uint16_t current_var_count;
+    double new_lower, new_upper, achieved;
+    std::size_t first_state;
+
+    // Initial values for traversal
+    candidates[0] = {{0, 0, PATH_ROOT}};
+
+    // For every node (in top order)
+    for (uint32_t i = 0; i < this->N-1; i++) {
+        // skip if no partial path reaches the node
+        if (candidates[i].size() == 0) {continue;}
+
+        // Get beginning and ending of edge-ids
+        if (i == 0) {
+            e_b = 0; e_e = this->nodes[i];
+        } else {
+            e_b = this->nodes[i - 1]; e_e = this->nodes[i];
+        }
+
+        // All predecessors were expanded (top order), merge the partial paths reaching this node
+        first_state = state.merge_candidates(i);
+
+        // For every state
+        for (std::size_t s = first_state; s < state.merged_states.size(); s++) {
             // For every outgoing edge of the node
             for (uint32_t k = e_b; k < e_e; k++) {
                 // Calculated the achieved weight, lower, upper and target_node
-                achieved = (tv_vals[i][j] + this->mono_weight[this->edges[k]]);
+                achieved = (state.merged_states[s].tv_val + this->mono_weight[this->edges[k]]);
+                if (this->edges_sorted && achieved > f_upper) {break;}  // Overshoots the query with this and all further edges (sorted by mass)
                 new_lower = f_lower - achieved;  // New lower 
                 new_upper = f_upper - achieved;  // New upper
                 target_node = this->edges[k];  // Target of Edge
 
+                // Additionally count the variants (if limited)
+                current_var_count = count_vars ? state.merged_states[s].var_count + this->variant_count[k] : 0;
+
                 // Check if we expand on this node
-                if (this->overlapping_interval(
+                if (
+                    (current_var_count <= max_vars)
+                    &&
+                    this->overlapping_interval(
                         target_node, 
                         new_lower, new_upper
                         )
                     ) {
                     // CASE: Expanding
-                    // Add new tv_val
-                    tv_vals[target_node].push_back(achieved);
-
-                    // Add new path how we achieved it
-                    paths[target_node].push_back(paths[i][j]);
-                    paths[target_node].back().push_back(target_node);
+                    candidates[target_node].push_back({achieved, (uint8_t) current_var_count, s});
                 } 
                 // CASE: No Exanding --> Skip entry
             }
         }
-        
+
         // Free memory during traversal, since older results can be removed (-> dag)!
-        tv_vals.erase(i);
-        paths.erase(i);
+        state.release(i);
     };
 
     // Return results
-    return convert_paths_to_fasta(paths[this->N-1]);
+    return convert_paths_to_fasta(state.unfold_paths(candidates[this->N-1], this->N-1));
 };
 
 
-std::string ProteinGraph::tvs_traverse_varcount_naive(int64_t lower, int64_t upper, uint8_t max_vars) {
-    
-    // State information
-    std::unordered_map<uint32_t, std::vector<double>> tv_vals;  // tv vals achieved and currently achieved by expanding
-    std::unordered_map<uint32_t, std::vector<uint8_t>> var_count;  // tv vals achieved and currently achieved by expanding
-    std::unordered_map<uint32_t, std::vector<std::vector<uint32_t>>> paths; // Paths which was taken to achieve the corresponding tv_val
+// Traversal answering a batch of queries (windows) at once. The partial paths are pruned against the union
+// of the windows and each path reaching the end node is assigned to the windows it satisfies, hence every
+// window receives the same paths (in the same order) as tvs_traverse_varcount_naive. max_vars holds the
+// variant limit per window (255 --> Variants are not limited, as in tvs_traverse_naive).
+std::vector<std::string> ProteinGraph::tvs_traverse_batch(const std::vector<std::tuple<int64_t, int64_t>>& windows, const std::vector<uint8_t>& max_vars) {
+    std::vector<std::vector<std::vector<uint32_t>>> window_paths = this->batch_paths(windows, max_vars, 0, 1);
 
-    double f_lower = (double)lower, f_upper = (double)upper;  // Convert query to doubles
+    // Return results (per window)
+    std::vector<std::string> results(windows.size());
+    for (std::size_t w = 0; w < windows.size(); w++) {
+        if (window_paths[w].size() != 0) {
+            results[w] = convert_paths_to_fasta(window_paths[w]);
+        }
+    }
+    return results;
+};
+
+// Part of tvs_traverse_batch (see naive_paths), the full paths per window
+std::vector<std::vector<std::vector<uint32_t>>> ProteinGraph::batch_paths(const std::vector<std::tuple<int64_t, int64_t>>& windows, const std::vector<uint8_t>& max_vars, std::uint32_t part, std::uint32_t parts) {
+
+    // A node with intervals which are not merged (see merge_intervals) may pass the union of the windows, but none
+    // of them, hence such a graph is traversed per window
+    std::vector<std::vector<std::vector<uint32_t>>> results;
+    for (std::uint32_t i = 0; i < this->N; i++) {
+        if (this->pdb_offsets[i + 1] == this->pdb_offsets[i] || this->pdbs[this->pdb_offsets[i]] != PDB_UNMERGED) {continue;}
+        for (std::size_t w = 0; w < windows.size(); w++) {
+            auto const& [lower, upper] = windows[w];
+            results.push_back((max_vars[w] == 255) ? this->naive_paths(lower, upper, part, parts) : this->varcount_paths(lower, upper, max_vars[w], part, parts));
+        }
+        return results;
+    }
+
+    // Union of the windows (disjoint and sorted) and the highest variant limit of the batch
+    std::vector<std::tuple<double, double>> union_windows;
+    for (auto const& [lower, upper] : windows) {
+        union_windows.push_back({(double) lower, (double) upper});
+    }
+    std::sort(union_windows.begin(), union_windows.end());
+    std::size_t num_union = 0;
+    for (std::size_t w = 1; w < union_windows.size(); w++) {
+        if (std::get<0>(union_windows[w]) <= std::get<1>(union_windows[num_union])) {
+            std::get<1>(union_windows[num_union]) = std::max(std::get<1>(union_windows[num_union]), std::get<1>(union_windows[w]));
+        } else {
+            union_windows[++num_union] = union_windows[w];
+        }
+    }
+    union_windows.resize(std::min(num_union + 1, union_windows.size()));
+    uint8_t batch_max_vars = *std::max_element(max_vars.begin(), max_vars.end());
+
+    // State information (per node, see TraversalScratch)
+    TraversalScratch& state = traversal_scratch;
+    state.reset(this->N);
+    std::vector<std::vector<double>>& tv_vals = state.tv_vals;  // tv vals achieved and currently achieved by expanding
+    std::vector<std::vector<uint8_t>>& var_count = state.var_count;  // Variants used to achieve the corresponding tv_val (at most 255)
+    std::vector<std::vector<std::size_t>>& paths = state.paths;  // Paths which were taken to achieve the corresponding tv_val
 
     // Variables during traversal
     uint32_t e_b, e_e, target_node;
     uint16_t current_var_count;
-    double new_lower, new_upper, achieved;
+    double achieved;
 
     // Initial values for traversal
     tv_vals[0] = {0};
     var_count[0] = {0};
-    paths[0] = {{0}};
+    paths[0] = {state.start_path()};
 
     // For every node (in top order)
     for (uint32_t i = 0; i < this->N-1; i++) {
@@ -412,44 +1154,52 @@ std::string ProteinGraph::tvs_traverse_varcount_naive(int64_t lower, int64_t upp
         for (uint32_t j = 0; j < tv_vals[i].size(); j++) {   
             // For every outgoing edge of the node
             for (uint32_t k = e_b; k < e_e; k++) {
-                // Calculated the achieved weight, lower, upper and target_node
+                if (i == 0 && k % parts != part) {continue;}  // Start edge of another part (see naive_paths)
+                // Calculated the achieved weight and target_node
                 achieved = (tv_vals[i][j] + this->mono_weight[this->edges[k]]);
-                new_lower = f_lower - achieved;  // New lower 
-                new_upper = f_upper - achieved;  // New upper
+                if (this->edges_sorted && achieved > std::get<1>(union_windows.back())) {break;}  // Overshoots all windows with this and all further edges (sorted by mass)
                 target_node = this->edges[k];  // Target of Edge
 
-                // Additionally count the variants
-                current_var_count = var_count[i][j] + this->variant_count[k];
+                // Additionally count the variants (saturating, the limits of the windows are checked at the end node)
+                current_var_count = std::min(var_count[i][j] + this->variant_count[k], 255);
 
-                // Check if we expand on this node
+                // Check if we expand on this node (for any of the windows)
                 if (
-                    (current_var_count <= max_vars)
+                    (batch_max_vars == 255 || current_var_count <= batch_max_vars)
                     &&
-                    this->overlapping_interval(
-                        target_node, 
-                        new_lower, new_upper
-                        )
+                    this->overlapping_windows(target_node, union_windows, achieved)
                     ) {
                     // CASE: Expanding
-                    // Add new tv_val
                     tv_vals[target_node].push_back(achieved);
-
-                    // Count up used variants
                     var_count[target_node].push_back(current_var_count);
-
-                    // Add new path how we achieved it
-                    paths[target_node].push_back(paths[i][j]);
-                    paths[target_node].back().push_back(target_node);
+                    paths[target_node].push_back(state.extend_path(paths[i][j], target_node));
                 } 
                 // CASE: No Exanding --> Skip entry
             }
         }
         
         // Free memory during traversal, since older results can be removed (-> dag)!
-        tv_vals.erase(i);
-        paths.erase(i);
+        state.release(i);
     };
 
-    // Return results
-    return convert_paths_to_fasta(paths[this->N-1]);
+    // Assign the paths at the end node to the windows they satisfy
+    results.resize(windows.size());
+    std::vector<std::size_t> window_paths;
+    for (std::size_t w = 0; w < windows.size(); w++) {
+        double lower = (double) std::get<0>(windows[w]), upper = (double) std::get<1>(windows[w]);
+        window_paths.clear();
+        for (std::size_t j = 0; j < paths[this->N-1].size(); j++) {
+            if (
+                (max_vars[w] == 255 || var_count[this->N-1][j] <= max_vars[w])
+                &&
+                this->overlapping_interval(this->N-1, lower - tv_vals[this->N-1][j], upper - tv_vals[this->N-1][j])
+            ) {
+                window_paths.push_back(paths[this->N-1][j]);
+            }
+        }
+        if (window_paths.size() != 0) {
+            results[w] = state.build_paths(window_paths);
+        }
+    }
+    return results;
 };
@@ -0,0 +1,91 @@
+#ifndef TASKSCHEDULER_H
+#define TASKSCHEDULER_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+
+// Hands out tasks (e.g. a graph of a query) to the worker threads. Each thread has its own deque, to which the tasks
+// of each submission are dealt in turn (the k-th to deque k % threads). A thread takes its tasks from the front and,
+// once its deque is empty, steals from the back of the other deques. Hence a query costs one push per task and one
+// pop per executed task (instead of every thread scanning all graphs), and the tasks are started roughly in their
+// order: submitted most expensive first, the threads start with the big ones and steal the small ones at the end.
+// Submissions only append, so the tasks of several queries can be queued at once.
+template<class Task>
+class TaskScheduler {
+    public:
+        explicit TaskScheduler(std::size_t num_threads) : deques(std::max<std::size_t>(num_threads, 1)) {};
+        TaskScheduler(const TaskScheduler&) = delete;
+        TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+        // Appends the tasks (of a query) and wakes the threads
+        void submit(const std::vector<Task>& tasks) {
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                this->queued += tasks.size();  // Counted first, a task can be taken as soon as it is pushed
+            }
+            std::size_t num = this->deques.size();
+            for (std::size_t t = 0; t < num; t++) {
+                std::lock_guard<std::mutex> lock(this->deques[t].mutex);
+                for (std::size_t k = t; k < tasks.size(); k += num) {
+                    this->deques[t].tasks.push_back(tasks[k]);
+                }
+            }
+            this->wakeup.notify_all();
+        };
+
+        // Next task of the thread (its own first, else stolen). Blocks while no task is queued, false once the
+        // scheduler was stopped and no task is left.
+        bool next(std::size_t thread, Task& task) {
+            while (true) {
+                for (std::size_t k = 0; k < this->deques.size(); k++) {
+                    TaskDeque& deque = this->deques[(thread + k) % this->deques.size()];
+                    std::lock_guard<std::mutex> lock(deque.mutex);
+                    if (deque.tasks.empty()) {continue;}
+                    if (k == 0) {
+                        task = deque.tasks.front();
+                        deque.tasks.pop_front();
+                    } else {
+                        task = deque.tasks.back();
+                        deque.tasks.pop_back();
+                    }
+                    this->queued.fetch_sub(1, std::memory_order_relaxed);
+                    return true;
+                }
+
+                std::unique_lock<std::mutex> lock(this->mutex);
+                this->wakeup.wait(lock, [&] { return this->stopped || this->queued.load(std::memory_order_relaxed) != 0; });
+                if (this->queued.load(std::memory_order_relaxed) == 0) {return false;}
+            }
+        };
+
+        // Lets all threads return from next (once the queued tasks are taken)
+        void stop() {
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                this->stopped = true;
+            }
+            this->wakeup.notify_all();
+        };
+
+    private:
+        struct TaskDeque {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+        };
+        std::vector<TaskDeque> deques;  // One per thread
+        std::atomic<std::size_t> queued{0};  // Tasks in all deques (counted before they are pushed, uncounted right after one is taken)
+
+        std::mutex mutex;
+        std::condition_variable wakeup;
+        bool stopped = false;
+};
+
+
+#endif
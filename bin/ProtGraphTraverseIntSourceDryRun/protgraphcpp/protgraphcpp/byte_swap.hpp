@@ -0,0 +1,51 @@
+#ifndef BYTESWAP_H
+#define BYTESWAP_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__SSSE3__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+
+// Converts a whole column of W-byte big-endian values (as read from a BPCSR-file) in place into host
+// order. The values are reversed with byte shuffles (32 bytes per step with AVX2, 16 with SSSE3), the
+// remainder (and machines without these extensions) are converted one value at a time.
+template<std::size_t W>
+inline void be_to_host_column(void* column, std::size_t num) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    char* data = (char*) column;
+    std::size_t bytes = num * W;
+    std::size_t i = 0;
+
+#if defined(__SSSE3__) || defined(__AVX2__)
+    // Byte j of a 16-byte block is taken from the mirrored position inside its value
+    alignas(16) char order[16];
+    for (int j = 0; j < 16; j++) {
+        order[j] = (char) (j / W * W + (W - 1 - j % W));
+    }
+    const __m128i mask = _mm_load_si128((const __m128i*) order);
+
+#if defined(__AVX2__)
+    const __m256i mask_256 = _mm256_broadcastsi128_si256(mask);  // The shuffle works per 128-bit lane
+    for (; i + 32 <= bytes; i += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i*) (data + i));
+        _mm256_storeu_si256((__m256i*) (data + i), _mm256_shuffle_epi8(block, mask_256));
+    }
+#endif
+    for (; i + 16 <= bytes; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*) (data + i));
+        _mm_storeu_si128((__m128i*) (data + i), _mm_shuffle_epi8(block, mask));
+    }
+#endif
+
+    for (; i < bytes; i += W) {
+        std::reverse(data + i, data + i + W);
+    }
+#endif
+}
+
+
+#endif
@@ -1,42 +1,201 @@
+#include <atomic>
+#include <charconv>
 #include <cstdint>
+#include <cstdio>
 #include <cstring>
 #include <string>
 #include <fstream>
 #include <endian.h>
+#include <exception>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "graph_loader.hpp"
 #include "protein_graph.hpp"
+#include "string_pool.hpp"
 #include <ulimit.h>
+#include <vector>
 
         
 std::vector<ProteinGraph>* GraphLoaderBinary::loadGraphs(std::string fileLoc) {
 
     // malloc and then return reference?
     std::vector<ProteinGraph>* pgs = new std::vector<ProteinGraph>;  // Ptr to vector
+    std::shared_ptr<StringPool> strings = std::make_shared<StringPool>();  // Shared by the loaded graphs (interned concurrently)
 
-    std::ifstream input(fileLoc, std::ios::binary);
+    uint32_t num_acc;
+
+    if (this->num_threads <= 1 && !this->accession_filter) {
+        // Sequentially parse, no need to scan the file first
+        std::ifstream input(fileLoc, std::ios::binary);
+
+        // // Get next entry and its global information about the entry
+        while (input.read((char*) &num_acc, 4)) {
+            pgs->push_back(ProteinGraph(num_acc, input, strings, this->columns));
+        }
+
+        // Closing the binary file, since eof is reached
+        input.close();
+        return pgs;
+    }
+
+    // Find where each graph starts, so that they can be parsed independently (and skipped if filtered)
+    std::vector<GraphIndexEntry> index = this->filterIndex(GraphLoaderBinary::loadIndex(fileLoc));
+    pgs->resize(index.size());
+
+    // Parse concurrently, each thread takes the next unparsed graph and places it at its position in the file
+    std::atomic<std::size_t> next_graph{0};
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    auto parse_graphs = [&]() {
+        std::ifstream input(fileLoc, std::ios::binary);
+        uint32_t num_acc;
+        try {
+            for (std::size_t i = next_graph.fetch_add(1); i < index.size(); i = next_graph.fetch_add(1)) {
+                input.seekg(index[i].offset);
+                input.read((char*) &num_acc, 4);
+                (*pgs)[i] = ProteinGraph(num_acc, input, strings, this->columns);
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if (!error) error = std::current_exception();
+            next_graph = index.size();  // Let the other threads stop early
+        }
+        input.close();
+    };
+
+    std::vector<std::thread> threads;
+    for (uint32_t t = 0; t < this->num_threads; t++) {
+        threads.push_back(std::thread(parse_graphs));
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    if (error) {
+        delete pgs;
+        std::rethrow_exception(error);
+    }
+
+    return pgs;
+};
+
+
+std::string GraphLoaderBinary::skipGraph(std::uint32_t num_acc, std::ifstream &input) {
+    uint32_t num_n, num_e, num_pdbs;
+    const std::streamsize until_end = std::numeric_limits<std::streamsize>::max();
+    std::string first_accession;
+
+    // Same layout as in the constructor of the ProteinGraph
+    num_acc = be32toh(num_acc);
+    input.read((char*) &num_n, 4); num_n = be32toh(num_n);
+    input.read((char*) &num_e, 4); num_e = be32toh(num_e);
+    input.read((char*) &num_pdbs, 4); num_pdbs = be32toh(num_pdbs);
+
+    // Skip AC (except the first one), NO, ED and SQ
+    if (num_acc > 0) { std::getline(input, first_accession, '\0'); }
+    for (uint32_t i = 1; i < num_acc; i++) { input.ignore(until_end, '\0'); }
+    input.seekg(((std::uint64_t) num_n + num_e) * 4, std::ios::cur);
+    for (uint32_t i = 0; i < num_n; i++) { input.ignore(until_end, '\0'); }
 
-    uint32_t num_acc, num_n, num_e, num_pdbs, cur_32bit;
-    uint8_t cur_8bit;
-    uint16_t cur_16bit;
-    uint64_t cur_64bit;
-    std::string cur_string;
+    // Skip PO, IS, IP, MW and CL
+    input.seekg((std::uint64_t) num_n * (2 + 1 + 2 + 8) + num_e, std::ios::cur);
 
-    // Debug Counter 
-    uint32_t counter = 0;
+    // Skip QU
+    for (uint32_t i = 0; i < num_e; i++) { input.ignore(until_end, '\0'); }
 
-    // // Get next entry and its global information about the entry
+    // Skip VC and PDB
+    input.seekg(num_e + (std::uint64_t) num_n * 2 * num_pdbs * 8, std::ios::cur);
+
+    return first_accession;
+}
+
+
+std::vector<GraphIndexEntry> GraphLoaderBinary::scanIndex(std::string fileLoc) {
+    std::vector<GraphIndexEntry> index;
+    std::ifstream input(fileLoc, std::ios::binary);
+    input.seekg(0, std::ios::end);
+    std::uint64_t file_size = input.tellg();
+    input.seekg(0, std::ios::beg);
+
+    uint32_t num_acc;
+    std::uint64_t offset = input.tellg();
     while (input.read((char*) &num_acc, 4)) {
-        pgs->push_back(ProteinGraph(num_acc, input));
-        // Print Progress (TODO this might slow us down!!)
-        // printf("\rParsed %i ProteinGraphs", counter);
-        std::fflush(stdout);
-        counter++;
-        
+        GraphIndexEntry entry;
+        entry.offset = offset;
+        entry.accession = GraphLoaderBinary::skipGraph(num_acc, input);
+        if (!input || (std::uint64_t) input.tellg() > file_size) {
+            throw std::runtime_error("Truncated BPCSR-file: " + fileLoc);
+        }
+        offset = input.tellg();
+        entry.size = offset - entry.offset;
+        index.push_back(entry);
+    }
+    if (offset != file_size) {
+        throw std::runtime_error("Truncated BPCSR-file: " + fileLoc);  // Trailing bytes of an incomplete graph
     }
 
-    // Closing the binary file, since eof is reached
     input.close();
+    return index;
+}
 
-    return pgs; // TODO DL return pointer
-};
+
+// The sidecar "<file>.idx" is a CSV. Its first line "#bpcsr2,<size>,<mtime>" identifies the BPCSR-file
+// it was built for, followed by the lines "<offset>,<size>,<first accession>" (one per graph, the accession is
+// last, since it may contain commas). A sidecar, which does not describe the whole file, is rebuilt.
+std::vector<GraphIndexEntry> GraphLoaderBinary::loadIndex(std::string fileLoc) {
+    std::vector<GraphIndexEntry> index;
+    std::string indexLoc = fileLoc + ".idx";
+
+    struct stat file_stat;
+    if (stat(fileLoc.c_str(), &file_stat) != 0) {
+        throw std::runtime_error("Could not open BPCSR-file: " + fileLoc);
+    }
+    std::string identifier = "#bpcsr2," + std::to_string(file_stat.st_size) + "," + std::to_string(file_stat.st_mtime);
+
+    // Use the sidecar, if it was built for this file (and its graphs follow each other up to the end of the file)
+    std::ifstream index_if(indexLoc);
+    std::string line;
+    if (std::getline(index_if, line) && line.compare(identifier) == 0) {
+        std::uint64_t end = 0;
+        while (std::getline(index_if, line)) {
+            GraphIndexEntry index_entry;
+            const char* last = line.data() + line.size();
+            auto [size_begin, offset_error] = std::from_chars(line.data(), last, index_entry.offset);
+            if (offset_error != std::errc() || size_begin == last || *size_begin != ',') {break;}
+            auto [accession_begin, size_error] = std::from_chars(size_begin + 1, last, index_entry.size);
+            if (size_error != std::errc() || accession_begin == last || *accession_begin != ',') {break;}
+            if (index_entry.offset != end || index_entry.size == 0) {break;}
+            index_entry.accession.assign(accession_begin + 1, last);
+            end = index_entry.offset + index_entry.size;
+            index.push_back(index_entry);
+        }
+        if (index_if.eof() && end == (std::uint64_t) file_stat.st_size) {
+            return index;
+        }
+        index.clear();  // Truncated or corrupt, the index is only a cache
+    }
+    index_if.close();
+
+    // Otherwise rebuild it and write it next to the file (if possible, e.g. the directory may be read-only)
+    index = GraphLoaderBinary::scanIndex(fileLoc);
+    std::string tmpLoc = indexLoc + ".tmp" + std::to_string(getpid());
+    std::ofstream index_of(tmpLoc, std::ios::trunc);
+    if (index_of) {
+        index_of << identifier << "\n";
+        for (auto const& index_entry : index) {
+            index_of << index_entry.offset << "," << index_entry.size << "," << index_entry.accession << "\n";
+        }
+        index_of.close();
+        if (!index_of || std::rename(tmpLoc.c_str(), indexLoc.c_str()) != 0) {
+            std::remove(tmpLoc.c_str());
+        }
+    }
+
+    return index;
+}
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <atomic>
 #include <cerrno>
 #include <condition_variable>
@@ -7,8 +8,8 @@
 #include <iostream>
 #include <fstream>
 #include <mutex>
+#include <numeric>
 #include <ostream>
-#include <queue>
 #include <sstream>
 #include <string>
 #include <sys/types.h>
@@ -18,45 +19,20 @@
 #include <thread>
 #include <tuple>
 #include <chrono>
+#include <stdexcept>
+#include <unordered_set>
 
 
 #include "protein_graph.hpp"
 #include "graph_loader.hpp"
+#include "mpmc_queue.hpp"
+#include "task_scheduler.hpp"
+#include "graph_costs.hpp"
 
 
-#define QUEUE_SIZE 10000
-
-template<class T, size_t MaxQueueSize>
-class Queue
-{
-    std::condition_variable consumer_, producer_;
-    std::mutex mutex_;
-    using unique_lock = std::unique_lock<std::mutex>;
-
-    std::queue<T> queue_;
-
-public:
-    template<class U>
-    void push_back(U&& item) {
-        unique_lock lock(mutex_);
-        while(MaxQueueSize == queue_.size())
-            producer_.wait(lock);
-        queue_.push(std::forward<U>(item));
-        consumer_.notify_one();
-    }
-
-    T pop_front() {
-        unique_lock lock(mutex_);
-        while(queue_.empty())
-            consumer_.wait(lock);
-        auto full = MaxQueueSize == queue_.size();
-        auto item = queue_.front();
-        queue_.pop();
-        if(full)
-            producer_.notify_all();
-        return item;
-    }
-};
+#define QUEUE_SIZE 16384  // Capacity of the output queue (a power of two, see MPMCQueue)
+#define QUEUE_POP_BATCH 64  // Results, which are taken from the output queue at once
+#define QUERIES_IN_FLIGHT 4  // Default number of queries, which are executed at once
 
 
 void throw_event_function(
@@ -77,158 +53,163 @@ void throw_event_function(
     event->store(true);
 }
 
-// TODO output queue
+// A query in flight (see main), the threads read its bounds while executing its tasks
+struct QueryState {
+    int64_t lower, upper;
+    std::vector<std::pair<std::size_t, std::string>> outputs;  // Graph and its results (collected by main)
+    std::atomic<std::size_t> remaining{0};  // Tasks, which are not executed yet
+    bool finished = false;  // All tasks are executed and their results collected
+};
+
+// A graph to traverse for a query (numbered in submission order, its state is queries[query % queries.size()])
+struct GraphTask {
+    std::size_t query;
+    std::size_t graph;
+};
+
+typedef std::tuple<std::size_t, std::size_t, std::string, bool> Result;  // Query, graph, its results and whether all tasks of the query are executed
+
+// Executes the tasks (graphs of any query in flight) which the scheduler hands to this thread. The thread which
+// executes the last task of a query reports it as finished.
 void thread_lifecycle(
-    Queue<std::tuple<int64_t, int64_t, uint8_t>, QUEUE_SIZE>& query, 
-    Queue<std::string, QUEUE_SIZE>& output_queue,
+    TaskScheduler<GraphTask>& scheduler,
+    std::size_t thread,
+    std::vector<QueryState>& queries,
+    MPMCQueue<Result, QUEUE_SIZE>& output_queue,
+    GraphCosts& costs,
     std::vector<ProteinGraph>& pgs,
-    std::atomic<bool>* pgs_executed,
-    std::atomic<bool>* pgs_timeout,
-    std::atomic<uint32_t>& atomic_pgs_finished,
-    uint32_t limit_query_in_seconds
+    uint32_t limit_query_in_seconds,
+    bool merge
     ){
 
-        bool iter_bool = false, should_execute = iter_bool;
-
-        std::tuple<int64_t, int64_t, uint8_t> next_query;
         std::string output_benchmark = "";
 
         int64_t lower, upper;
-        while(true) {
-            // Get next query
-            next_query = query.pop_front();
-
-            // Stop Condition reached terminate thread
-            if (std::get<2>(next_query) == uint8_t(-1)) break;
+        GraphTask task;
+        std::size_t i;
+        while(scheduler.next(thread, task)) {
+            QueryState& state = queries[task.query % queries.size()];
+            i = task.graph;
 
             //Set query params
-            lower = std::get<0>(next_query);
-            upper = std::get<1>(next_query);
-
-            // Scan bool vector
-            for (uint32_t i = 0; i < pgs.size(); i++){
-                // Check if it was already executed by another thread
-                pgs_executed[i].compare_exchange_strong(should_execute, !iter_bool);
-                if (should_execute == iter_bool) {
-
-                    std::atomic<bool> timeout_timeout;
-                    timeout_timeout.store(false);
-                    std::thread throw_event = std::thread(
-                        throw_event_function,
-                        &pgs_timeout[i],
-                        &timeout_timeout,
-                        limit_query_in_seconds
-                    );
-
-                    // It was not executed by another thread, execute now!
-                    output_benchmark += pgs.at(i).tvs_traverse_naive(lower,  upper, &pgs_timeout[i]);
-
-                    timeout_timeout.store(true);
-                    throw_event.join();
-                    pgs_timeout[i].store(false);
-
-
-                    if (output_benchmark.length() != 0) {
-                        output_queue.push_back(output_benchmark);
-                        output_benchmark = "";
-                    }
-                    int finished_count = atomic_pgs_finished.fetch_add(1, std::memory_order_acq_rel);
-                    if (finished_count >= pgs.size() - 1) {
-                        //  Only 1 Thread should be active here!!!
-                        // std::cerr << "Thread pushing end signal" << std::endl;
-                        output_queue.push_back("TODO FINISHED CALCULATING");
-                        atomic_pgs_finished.exchange(0);
-                    }
-                } 
-                // Update should_execute due to the atomic replacing its value
-                should_execute = iter_bool;
+            lower = state.lower;
+            upper = state.upper;
+
+            // Per task, the same graph may be traversed for another query at the same time
+            std::atomic<bool> timeout(false);
+            std::atomic<bool> timeout_timeout;
+            timeout_timeout.store(false);
+            std::thread throw_event = std::thread(
+                throw_event_function,
+                &timeout,
+                &timeout_timeout,
+                limit_query_in_seconds
+            );
+
+            // Execute now!
+            std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+            if (merge) {
+                output_benchmark += pgs.at(i).tvs_traverse_merged(lower,  upper, 255, &timeout);
+            } else {
+                output_benchmark += pgs.at(i).tvs_traverse_naive(lower,  upper, &timeout);
+            }
+
+            costs.measured(i, std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count());
+            timeout_timeout.store(true);
+            throw_event.join();
+
+
+            if (output_benchmark.length() != 0) {
+                output_queue.push_back(Result(task.query, i, std::move(output_benchmark), false));
+                output_benchmark = "";
+            }
+            if (state.remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                //  Only the thread of the last task of the query gets here
+                output_queue.push_back(Result(task.query, 0, "", true));
             }
-            // Update bools
-            iter_bool = !iter_bool;
-            should_execute = iter_bool;
-            
-            
         }
 
 }
 
-// TODO output queue
+// Same, limited by the number of variants
 void thread_lifecycle_var_count(
-    Queue<std::tuple<int64_t, int64_t, uint8_t>, QUEUE_SIZE>& query, 
-    Queue<std::string, QUEUE_SIZE>& output_queue,
+    TaskScheduler<GraphTask>& scheduler,
+    std::size_t thread,
+    std::vector<QueryState>& queries,
+    MPMCQueue<Result, QUEUE_SIZE>& output_queue,
+    GraphCosts& costs,
     std::vector<ProteinGraph>& pgs,
-    std::atomic<bool>* pgs_executed,
-    std::atomic<bool>* pgs_timeout,
-    std::atomic<uint32_t>& atomic_pgs_finished,
     uint8_t varcount,
-    uint32_t limit_query_in_seconds
+    uint32_t limit_query_in_seconds,
+    bool merge
     ){
 
-        bool iter_bool = false, should_execute = iter_bool;
-
-        std::tuple<int64_t, int64_t, uint8_t> next_query;
         std::string output_benchmark = "";
 
         int64_t lower, upper;
-        while(true) {
-            // Get next query
-            next_query = query.pop_front();
-
-            // Stop Condition reached terminate thread
-            if (std::get<2>(next_query) == uint8_t(-1)) break;
+        GraphTask task;
+        std::size_t i;
+        while(scheduler.next(thread, task)) {
+            QueryState& state = queries[task.query % queries.size()];
+            i = task.graph;
 
             //Set query params
-            lower = std::get<0>(next_query);
-            upper = std::get<1>(next_query);
-
-            // Scan bool vector
-            for (uint32_t i = 0; i < pgs.size(); i++){
-                // Check if it was already executed by another thread
-                pgs_executed[i].compare_exchange_strong(should_execute, !iter_bool);
-                if (should_execute == iter_bool) {
-
-                    std::atomic<bool> timeout_timeout;
-                    timeout_timeout.store(false);
-                    std::thread throw_event = std::thread(
-                        throw_event_function,
-                        &pgs_timeout[i],
-                        &timeout_timeout,
-                        limit_query_in_seconds
-                    );
-
-                    // It was not executed by another thread, execute now!
-                    output_benchmark += pgs.at(i).tvs_traverse_varcount_naive(lower,  upper, varcount, &pgs_timeout[i]);
-
-                    timeout_timeout.store(true);
-                    throw_event.join();
-                    pgs_timeout[i].store(false);
-
-
-                    if (output_benchmark.length() != 0) {
-                        output_queue.push_back(output_benchmark);
-                        output_benchmark = "";
-                    }
-                    int finished_count = atomic_pgs_finished.fetch_add(1, std::memory_order_acq_rel);
-                    if (finished_count >= pgs.size() - 1) {
-                        //  Only 1 Thread should be active here!!!
-                        // std::cerr << "Thread pushing end signal" << std::endl;
-                        output_queue.push_back("TODO FINISHED CALCULATING");
-                        atomic_pgs_finished.exchange(0);
-                    }
-                } 
-                // Update should_execute due to the atomic replacing its value
-                should_execute = iter_bool;
+            lower = state.lower;
+            upper = state.upper;
+
+            // Per task, the same graph may be traversed for another query at the same time
+            std::atomic<bool> timeout(false);
+            std::atomic<bool> timeout_timeout;
+            timeout_timeout.store(false);
+            std::thread throw_event = std::thread(
+                throw_event_function,
+                &timeout,
+                &timeout_timeout,
+                limit_query_in_seconds
+            );
+
+            // Execute now!
+            std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+            if (merge) {
+                output_benchmark += pgs.at(i).tvs_traverse_merged(lower,  upper, varcount, &timeout);
+            } else {
+                output_benchmark += pgs.at(i).tvs_traverse_varcount_naive(lower,  upper, varcount, &timeout);
+            }
+
+            costs.measured(i, std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count());
+            timeout_timeout.store(true);
+            throw_event.join();
+
+
+            if (output_benchmark.length() != 0) {
+                output_queue.push_back(Result(task.query, i, std::move(output_benchmark), false));
+                output_benchmark = "";
+            }
+            if (state.remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                //  Only the thread of the last task of the query gets here
+                output_queue.push_back(Result(task.query, 0, "", true));
             }
-            // Update bools
-            iter_bool = !iter_bool;
-            should_execute = iter_bool;
-            
-            
         }
 
 }
 
 
+// Reads the accessions of an allow- or deny-list (one accession per line)
+std::unordered_set<std::string> read_accessions(std::string fileLoc) {
+    std::ifstream accessions_file(fileLoc);
+    if (!accessions_file) {
+        throw std::runtime_error("Could not open accession list: " + fileLoc);
+    }
+    std::unordered_set<std::string> accessions;
+    std::string accession;
+    while (std::getline(accessions_file, accession)) {
+        if (!accession.empty() && accession.back() == '\r') accession.pop_back();
+        if (!accession.empty()) accessions.insert(accession);
+    }
+    return accessions;
+}
+
+
 int main(int argc, char *argv[]) {
     // printf("ProtGraphCpp, a (hopefully fast) Peptide Query Engine\n");
 
@@ -238,23 +219,53 @@ int main(int argc, char *argv[]) {
     std::string::size_type idx = FILENAME.rfind('.');
     std::string extension = FILENAME.substr(idx+1);
 
+    // Get the number of available threads (also used for loading)
+    int num_threads = 0;
+    if (atoi(argv[3]) == -1) {
+        num_threads = std::thread::hardware_concurrency();
+    } else {
+        num_threads = atoi(argv[3]);
+    }    
+
     GraphLoader* gl;
     if (extension.compare("bpcsr") == 0) {
-        gl = new GraphLoaderBinary();
+        gl = new GraphLoaderBinary(num_threads, COLUMNS_TRAVERSAL);  // Sequences, positions, ... are not needed
+    } else if (extension.compare("mpcsr") == 0) {
+        gl = new GraphLoaderMapped(COLUMNS_TRAVERSAL);  // Converted via protgraphconvertint
+    } else if (extension.compare("cpcsr") == 0) {
+        gl = new GraphLoaderCompressed(num_threads, COLUMNS_TRAVERSAL);  // Converted via protgraphconvertint
+    }
+
+    // Optional flags (after the positional parameters)
+    bool merge = false;
+    std::size_t in_flight = QUERIES_IN_FLIGHT;
+    bool filtered = false;
+    for (int i = 7; i < argc; i++) {
+        std::string flag = argv[i];
+        if (flag.compare("--merge") == 0) {
+            // Traverse with merged states (see ProteinGraph::tvs_traverse_merged)
+            merge = true;
+        } else if (flag.starts_with("--in-flight=")) {
+            // Number of queries, which are executed at once (their results are still written in query order)
+            in_flight = std::max(std::stoull(flag.substr(12)), 1ULL);
+        } else if (flag.starts_with("--include=") || flag.starts_with("--exclude=")) {
+            // Only the graphs of the listed accessions (or all but these) are loaded
+            if (filtered) {
+                std::cerr << "Only one of --include and --exclude can be given" << std::endl;
+                return 1;
+            }
+            filtered = true;
+            gl->filterAccessions(read_accessions(flag.substr(10)), flag.starts_with("--exclude="));
+        } else {
+            std::cerr << "Unknown parameter: " << flag << std::endl;
+            return 1;
+        }
     }
 
     // Get Protein Graphs
     std::vector<ProteinGraph>* pgs = gl->loadGraphs(FILENAME);
     printf("\n");
 
-    // Get the number of available threads
-    int num_threads = 0;
-    if (atoi(argv[3]) == -1) {
-        num_threads = std::thread::hardware_concurrency();
-    } else {
-        num_threads = atoi(argv[3]);
-    }    
-
     // Output CSV File
     std::ofstream output_file(argv[4]);
 
@@ -265,25 +276,20 @@ int main(int argc, char *argv[]) {
     uint32_t limit_query_in_seconds = atoi(argv[6]);
 
     // Set Queues
-    Queue<std::tuple<int64_t, int64_t, uint8_t>, QUEUE_SIZE> query;
-    Queue<std::string, QUEUE_SIZE> output_queue;
-
-    // Set bool vector if executed
-    // std::vector<bool> pgs_executed(pgs->size(), false);
-    // bool* pgs_executed = new bool[pgs->size()];
-    // for (int i = 0; i < pgs->size(); i++){
-    //     pgs_executed[i] = false;
-    // }
-    std::atomic<bool>* pgs_executed = new std::atomic<bool>[pgs->size()];
-    std::atomic<bool>* pgs_timeout  = new std::atomic<bool>[pgs->size()];
-
-    for (int i = 0; i < pgs->size(); i++){
-        pgs_executed[i].exchange(false);
-        pgs_timeout[i].exchange(false);
+    TaskScheduler<GraphTask> scheduler(num_threads);
+    MPMCQueue<Result, QUEUE_SIZE> output_queue;
+
+    // The graphs of each query are dispatched most expensive first (see GraphCosts)
+    std::vector<std::size_t> graphs(pgs->size());
+    std::iota(graphs.begin(), graphs.end(), 0);
+    std::vector<double> estimates;
+    for (std::size_t graph : graphs) {
+        estimates.push_back((*pgs)[graph].estimated_cost());
     }
+    GraphCosts costs(pgs->size(), graphs, estimates);
 
-    // Create atomic counter of executed entries
-    std::atomic<uint32_t> atomic_pgs_finished{0};
+    // The queries in flight (a state is reused, once its query is written)
+    std::vector<QueryState> queries(in_flight);
 
 
     // Create Thread pool after retrieving all needed information
@@ -293,21 +299,21 @@ int main(int argc, char *argv[]) {
         for (int i = 0; i < num_threads; i++) {
             threads.push_back(std::thread(
                 thread_lifecycle, // Method
-                std::ref(query), std::ref(output_queue), //Params
-                std::ref(*pgs), std::ref(pgs_executed), std::ref(pgs_timeout),
-                std::ref(atomic_pgs_finished),
-                limit_query_in_seconds
+                std::ref(scheduler), i, std::ref(queries), std::ref(output_queue), std::ref(costs), //Params
+                std::ref(*pgs),
+                limit_query_in_seconds,
+                merge
             ));
         }
     } else {
         for (int i = 0; i < num_threads; i++) {
             threads.push_back(std::thread(
                 thread_lifecycle_var_count, //Method
-                std::ref(query), std::ref(output_queue), //Params
-                std::ref(*pgs), std::ref(pgs_executed), std::ref(pgs_timeout),
-                std::ref(atomic_pgs_finished),
+                std::ref(scheduler), i, std::ref(queries), std::ref(output_queue), std::ref(costs), //Params
+                std::ref(*pgs),
                 var_limit,
-                limit_query_in_seconds
+                limit_query_in_seconds,
+                merge
             ));
         }
     }
@@ -326,33 +332,67 @@ int main(int argc, char *argv[]) {
     int64_t upper;
     int query_counter = 1;
 
-    while (std::getline(query_file, line)) {
-        // Parse Query
-        ss_line.clear();
-        ss_line.str(line);
-        std::getline(ss_line, entry, ',');
-        lower = (int64_t)(std::stod(entry) * 1000000000);
-        std::getline(ss_line, entry, '\n');
-        upper = (int64_t)(std::stod(entry) * 1000000000);
-        std::tuple<int64_t, int64_t, uint8_t> query_tuple(lower, upper, 1);
-
-        //Submit Query
-        for (int i = 0; i < num_threads; i++) {
-            query.push_back(query_tuple);
-        }
-
-        // Wait for the results!
-        while (true) {
-            std::string output = output_queue.pop_front();
-            if (output.starts_with("TODO FINISHED CALCULATING")){
+    std::size_t submitted = 0, written = 0;
+    bool queries_left = true;
+    std::vector<GraphTask> tasks;
+    std::vector<Result> outputs;
+    while (true) {
+        // Submit queries until in_flight are in flight
+        while (queries_left && submitted - written < queries.size()) {
+            if (!std::getline(query_file, line)) {
+                queries_left = false;
                 break;
             }
-            // std::cout << output; // E.G.: here we could simply pass it through the socket
-            output_file << output;
 
+            // Parse Query
+            ss_line.clear();
+            ss_line.str(line);
+            std::getline(ss_line, entry, ',');
+            lower = (int64_t)(std::stod(entry) * 1000000000);
+            std::getline(ss_line, entry, '\n');
+            upper = (int64_t)(std::stod(entry) * 1000000000);
+
+            //Submit Query
+            QueryState& state = queries[submitted % queries.size()];
+            state.lower = lower;
+            state.upper = upper;
+            state.finished = pgs->empty();
+            state.remaining.store(pgs->size(), std::memory_order_relaxed);
+            tasks.clear();
+            for (std::size_t i : costs.order()) {
+                tasks.push_back(GraphTask{submitted, i});
+            }
+            scheduler.submit(tasks);
+            submitted++;
+        }
+        if (written == submitted) break;
+
+        // Wait for the results of the oldest query (the results of the others are collected meanwhile)
+        QueryState& state = queries[written % queries.size()];
+        if (!state.finished) {
+            outputs.clear();
+            output_queue.pop_batch(outputs, QUEUE_POP_BATCH);
+            for (auto& output : outputs) {
+                QueryState& output_state = queries[std::get<0>(output) % queries.size()];
+                if (std::get<3>(output)) {
+                    output_state.finished = true;
+                } else {
+                    output_state.outputs.emplace_back(std::get<1>(output), std::move(std::get<2>(output)));
+                }
+            }
+            continue;
+        }
+
+        // std::cout << output; // E.G.: here we could simply pass it through the socket
+        // In graph order
+        std::sort(state.outputs.begin(), state.outputs.end(), [](auto const& a, auto const& b) { return a.first < b.first; });
+        for (auto const& output : state.outputs) {
+            output_file << output.second;
         }
+        state.outputs.clear();
+        written++;
 
-        std::cerr << "Processed Query " << query_counter << " with: " << lower << ":" << upper << std::endl;
+        std::cerr << "Processed Query " << query_counter << " with: " << state.lower << ":" << state.upper << std::endl;
         query_counter++;
     }
     // Repeat next Query
@@ -361,11 +401,7 @@ int main(int argc, char *argv[]) {
 
     // Spin down
     // std::cout << "Spinning Down..." << std::endl;
-    std::tuple<int64_t, int64_t, uint8_t> stop_tuple(0, 0, uint8_t(-1));
-    for (int i = 0; i < num_threads; i++)
-    {
-        query.push_back(stop_tuple);
-    }
+    scheduler.stop();
     for (int i = 0; i < num_threads; i++)
     {
         threads.at(i).join();
@@ -1,24 +1,163 @@
 #ifndef GRAPHLOADER_H
 #define GRAPHLOADER_H
 
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
 
 #include "protein_graph.hpp"
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+
+// Entry of the index (sidecar "<file>.idx") of a BPCSR-file
+struct GraphIndexEntry {
+    std::string accession;  // First accession of the graph
+    std::uint64_t offset;  // Beginning of the graph in the file
+    std::uint64_t size;  // Number of bytes of the graph in the file
+};
 
 
 class GraphLoader{
     public:
         virtual ~GraphLoader() = default;
         virtual std::vector<ProteinGraph>* loadGraphs(std::string fileLoc, std::unordered_map<std::string, std::vector<uint8_t>> max_vars) = 0;
+
+        // Hooks for loaders, which keep graphs only on demand in memory (the others load everything up front)
+        virtual void acquireGraph([[maybe_unused]] std::vector<ProteinGraph>& pgs, [[maybe_unused]] std::size_t i) {};  // Graph i is needed now
+        virtual void releaseGraph([[maybe_unused]] std::vector<ProteinGraph>& pgs, [[maybe_unused]] std::size_t i) {};  // Graph i is not needed anymore
+        virtual double estimatedCost(const std::vector<ProteinGraph>& pgs, std::size_t i) const { return pgs[i].estimated_cost(); };  // To order the graphs by (see GraphCosts)
+        virtual std::uint32_t startEdges(const std::vector<ProteinGraph>& pgs, std::size_t i) const { return pgs[i].start_edges(); };  // Most parts to traverse graph i in
+
+        // Restricts the graphs to load by their (first) accession: only the listed ones (allow-list) or all but
+        // the listed ones (deny-list). The other graphs are skipped without being built.
+        void filterAccessions(std::unordered_set<std::string> accessions, bool deny = false) {
+            this->accession_filter = std::move(accessions);
+            this->deny_listed = deny;
+        };
+        bool acceptsAccession(const std::string& accession) const {
+            return !this->accession_filter || (this->accession_filter->count(accession) != 0) != this->deny_listed;
+        };
+        // Entries of the index, whose graphs are accepted
+        std::vector<GraphIndexEntry> filterIndex(std::vector<GraphIndexEntry> index) const {
+            if (this->accession_filter) {
+                std::erase_if(index, [this](const GraphIndexEntry& entry) { return !this->acceptsAccession(entry.accession); });
+            }
+            return index;
+        };
+
+        // Prunes the loaded graphs to what queries up to max_mass can report (see ProteinGraph::prune)
+        void pruneToMass(std::int64_t max_mass) { this->max_mass = max_mass; };
+
+    protected:
+        // Called by the loaders on each built graph (graphs without variant limits are never traversed, hence kept whole)
+        void pruneGraph(ProteinGraph& pg) const {
+            if (this->max_mass && pg.num_bins != 0) { pg.prune(*this->max_mass); }
+        };
+
+        std::optional<std::unordered_set<std::string>> accession_filter;  // Not set --> all graphs are loaded
+        bool deny_listed = false;
+        std::optional<std::int64_t> max_mass;  // Not set --> the graphs are not pruned
 };
 
 
 class GraphLoaderBinary: public GraphLoader {
     public:
+        GraphLoaderBinary(uint32_t num_threads = 1, std::uint32_t columns = COLUMNS_ALL) : num_threads(num_threads), columns(columns) {};
         ~GraphLoaderBinary() = default;
         
         std::vector<ProteinGraph>* loadGraphs(std::string fileLoc, std::unordered_map<std::string, std::vector<uint8_t>> max_vars);
+        // Loads only the graphs [first, last) of the index
+        std::vector<ProteinGraph>* loadGraphs(std::string fileLoc, const std::vector<GraphIndexEntry>& index, std::size_t first, std::size_t last, const std::unordered_map<std::string, std::vector<uint8_t>>& max_vars);
+
+        // Returns the index of the BPCSR-file, read from its sidecar if up to date (else it is rebuilt and written)
+        static std::vector<GraphIndexEntry> loadIndex(std::string fileLoc);
+        // Finds the beginning of each graph in the BPCSR-file (without parsing the graphs)
+        static std::vector<GraphIndexEntry> scanIndex(std::string fileLoc);
+        // Skips the remainder of a graph, after its number of accessions was read (as in the ProteinGraph). Returns its first accession
+        static std::string skipGraph(std::uint32_t num_acc, std::ifstream &input);
+
+    private:
+        uint32_t num_threads;  // Number of threads, which parse graphs concurrently
+        std::uint32_t columns;  // Requested columns (see protein_graph.hpp)
+};
+
+
+// Loads a graph of a BPCSR-file only when it is first needed (using the index). Until then, only its
+// accession and variant limits are set. If the loaded graphs exceed the resident limit, the least
+// recently used graphs (which are currently not used) are evicted again.
+class GraphLoaderLazy: public GraphLoader {
+    public:
+        GraphLoaderLazy(std::uint64_t resident_limit = 0) : resident_limit(resident_limit) {};  // 0 --> never evict
+        ~GraphLoaderLazy() = default;
+
+        std::vector<ProteinGraph>* loadGraphs(std::string fileLoc, std::unordered_map<std::string, std::vector<uint8_t>> max_vars);
+
+        void acquireGraph(std::vector<ProteinGraph>& pgs, std::size_t i);
+        void releaseGraph(std::vector<ProteinGraph>& pgs, std::size_t i);
+        // The size of its record, since a graph is not loaded yet (only relative to the other graphs, see GraphCosts)
+        double estimatedCost(const std::vector<ProteinGraph>&, std::size_t i) const { return (double) this->index[i].size; };
+        // Not known before the graph is loaded (parts without start edges find no paths)
+        std::uint32_t startEdges(const std::vector<ProteinGraph>&, std::size_t) const { return UINT32_MAX; };
+
+    private:
+        struct LazyState {
+            std::mutex mutex;
+            bool loaded = false;
+            std::uint32_t users = 0;  // Number of threads currently working on the graph
+            std::list<std::size_t>::iterator lru_pos;  // Position in the lru list (if loaded)
+        };
+
+        void evictCold(std::vector<ProteinGraph>& pgs);
+
+        std::string fileLoc;
+        std::unordered_map<std::string, std::vector<uint8_t>> max_vars;
+        std::shared_ptr<StringPool> strings;
+        std::vector<GraphIndexEntry> index;
+        std::unique_ptr<LazyState[]> states;
+
+        std::uint64_t resident_limit;  // In bytes (of the BPCSR-file)
+        std::atomic<std::uint64_t> resident{0};
+
+        std::mutex lru_mutex;
+        std::list<std::size_t> lru;  // Loaded graphs, most recently used first
+};
+
+
+class GraphLoaderMapped: public GraphLoader {
+    public:
+        GraphLoaderMapped(std::uint32_t columns = COLUMNS_ALL) : columns(columns) {};
+        ~GraphLoaderMapped() = default;
+
+        std::vector<ProteinGraph>* loadGraphs(std::string fileLoc, std::unordered_map<std::string, std::vector<uint8_t>> max_vars);
+
+        // One-time conversion of a BPCSR-file into the (mmappable) MPCSR-file
+        static void convert(std::string bpcsrLoc, std::string mpcsrLoc);
+
+    private:
+        std::uint32_t columns;  // Requested columns (see protein_graph.hpp)
+};
+
+
+// Loads a CPCSR-file (see compressed_graph_format.hpp), its blocks are decompressed and parsed concurrently
+class GraphLoaderCompressed: public GraphLoader {
+    public:
+        GraphLoaderCompressed(uint32_t num_threads = 1, std::uint32_t columns = COLUMNS_ALL) : num_threads(num_threads), columns(columns) {};
+        ~GraphLoaderCompressed() = default;
+
+        std::vector<ProteinGraph>* loadGraphs(std::string fileLoc, std::unordered_map<std::string, std::vector<uint8_t>> max_vars);
+
+        // One-time conversion of a BPCSR-file into the (block-compressed) CPCSR-file
+        static void convert(std::string bpcsrLoc, std::string cpcsrLoc);
+
+    private:
+        uint32_t num_threads;  // Number of threads, which decompress and parse graphs concurrently
+        std::uint32_t columns;  // Requested columns (see protein_graph.hpp)
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,100 @@
+#include <cstdint>
+#include <string>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include "graph_loader.hpp"
+#include "protein_graph.hpp"
+#include "string_pool.hpp"
+#include <unordered_map>
+#include <vector>
+
+
+// Creates a not yet loaded graph, which only knows its accession and variant limits
+static ProteinGraph unloaded_graph(const GraphIndexEntry& entry, const std::unordered_map<std::string, std::vector<uint8_t>>& max_vars) {
+    ProteinGraph pg{};  // All columns are null
+    pg.accessions.push_back(entry.accession);
+    pg.set_max_vars(max_vars);
+    return pg;
+}
+
+
+std::vector<ProteinGraph>* GraphLoaderLazy::loadGraphs(std::string fileLoc, std::unordered_map<std::string, std::vector<uint8_t>> max_vars) {
+    this->fileLoc = fileLoc;
+    this->max_vars = max_vars;
+    this->strings = std::make_shared<StringPool>();  // Evicted graphs keep their strings, a reload finds them again
+    this->index = this->filterIndex(GraphLoaderBinary::loadIndex(fileLoc));
+    this->states = std::make_unique<LazyState[]>(this->index.size());
+
+    // Only the index is read, the graphs themselves are loaded in acquireGraph
+    std::vector<ProteinGraph>* pgs = new std::vector<ProteinGraph>;  // Ptr to vector
+    pgs->reserve(this->index.size());
+    for (auto const& entry : this->index) {
+        pgs->push_back(unloaded_graph(entry, this->max_vars));
+    }
+
+    return pgs;
+};
+
+
+void GraphLoaderLazy::acquireGraph(std::vector<ProteinGraph>& pgs, std::size_t i) {
+    LazyState& state = this->states[i];
+    std::lock_guard<std::mutex> lock(state.mutex);
+    state.users++;
+
+    // Graphs without variant limits are never traversed, hence they are not loaded
+    if (pgs[i].num_bins == 0) return;
+
+    if (!state.loaded) {
+        std::ifstream input(this->fileLoc, std::ios::binary);
+        if (!input.seekg(this->index[i].offset)) {
+            throw std::runtime_error("Could not read graph " + this->index[i].accession + " from: " + this->fileLoc);
+        }
+        uint32_t num_acc;
+        input.read((char*) &num_acc, 4);
+        pgs[i] = ProteinGraph(num_acc, input, this->strings, this->max_vars);
+        this->pruneGraph(pgs[i]);
+        input.close();
+
+        state.loaded = true;
+        this->resident += this->index[i].size;
+        std::lock_guard<std::mutex> lru_lock(this->lru_mutex);
+        this->lru.push_front(i);
+        state.lru_pos = this->lru.begin();
+    } else {
+        std::lock_guard<std::mutex> lru_lock(this->lru_mutex);
+        this->lru.splice(this->lru.begin(), this->lru, state.lru_pos);
+    }
+}
+
+
+void GraphLoaderLazy::releaseGraph(std::vector<ProteinGraph>& pgs, std::size_t i) {
+    {
+        std::lock_guard<std::mutex> lock(this->states[i].mutex);
+        this->states[i].users--;
+    }
+    if (this->resident_limit != 0 && this->resident > this->resident_limit) {
+        this->evictCold(pgs);
+    }
+}
+
+
+// Evicts the least recently used graphs until the resident limit is met again. Graphs which are
+// currently used (or locked by another thread) are skipped.
+void GraphLoaderLazy::evictCold(std::vector<ProteinGraph>& pgs) {
+    std::lock_guard<std::mutex> lru_lock(this->lru_mutex);
+    auto it = this->lru.end();
+    while (it != this->lru.begin() && this->resident > this->resident_limit) {
+        --it;
+        std::size_t i = *it;
+        LazyState& state = this->states[i];
+        std::unique_lock<std::mutex> lock(state.mutex, std::try_to_lock);
+        if (!lock.owns_lock() || state.users != 0) continue;
+
+        pgs[i] = unloaded_graph(this->index[i], this->max_vars);  // Frees the columns of the loaded graph
+        state.loaded = false;
+        this->resident -= this->index[i].size;
+        it = this->lru.erase(it);
+    }
+}
@@ -0,0 +1,90 @@
+#ifndef INTERVALOVERLAP_H
+#define INTERVALOVERLAP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+#if defined(__SSE2__) || defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+
+// Checks whether [lower, upper] overlaps any of the intervals of a node, given as num values (lower and upper
+// bound of each interval). All values of a register are tested at once: a lane of a lower bound fails if it
+// is above upper, a lane of an upper bound fails if it is below lower. An interval overlaps, if both of its
+// lanes pass. With AVX-512 8 values are tested per step, with AVX2 4 and with SSE 2 (SSE4.2 for integers),
+// the remaining intervals one by one.
+inline bool overlapping_intervals(const std::int64_t* intervals, std::size_t num, std::int64_t lower, std::int64_t upper) {
+    std::size_t i = 0;
+#if defined(__AVX512F__)
+    const __m512i uppers = _mm512_set_epi64(INT64_MAX, upper, INT64_MAX, upper, INT64_MAX, upper, INT64_MAX, upper);
+    const __m512i lowers = _mm512_set_epi64(lower, INT64_MIN, lower, INT64_MIN, lower, INT64_MIN, lower, INT64_MIN);
+    for (; i + 8 <= num; i += 8) {
+        __m512i values = _mm512_loadu_si512((const void*) (intervals + i));
+        unsigned passed = ~(_mm512_cmpgt_epi64_mask(values, uppers) | _mm512_cmpgt_epi64_mask(lowers, values));
+        if (passed & (passed >> 1) & 0x55) return true;
+    }
+#elif defined(__AVX2__)
+    const __m256i uppers = _mm256_set_epi64x(INT64_MAX, upper, INT64_MAX, upper);
+    const __m256i lowers = _mm256_set_epi64x(lower, INT64_MIN, lower, INT64_MIN);
+    for (; i + 4 <= num; i += 4) {
+        __m256i values = _mm256_loadu_si256((const __m256i*) (intervals + i));
+        __m256i failed = _mm256_or_si256(_mm256_cmpgt_epi64(values, uppers), _mm256_cmpgt_epi64(lowers, values));
+        unsigned passed = ~_mm256_movemask_pd(_mm256_castsi256_pd(failed));
+        if (passed & (passed >> 1) & 0x5) return true;
+    }
+#elif defined(__SSE4_2__)
+    const __m128i uppers = _mm_set_epi64x(INT64_MAX, upper);
+    const __m128i lowers = _mm_set_epi64x(lower, INT64_MIN);
+    for (; i + 2 <= num; i += 2) {
+        __m128i values = _mm_loadu_si128((const __m128i*) (intervals + i));
+        __m128i failed = _mm_or_si128(_mm_cmpgt_epi64(values, uppers), _mm_cmpgt_epi64(lowers, values));
+        if (_mm_movemask_pd(_mm_castsi128_pd(failed)) == 0) return true;
+    }
+#endif
+    for (; i + 2 <= num; i += 2) {
+        if (intervals[i] <= upper && intervals[i + 1] >= lower) return true;
+    }
+    return false;
+}
+
+
+// Same for intervals of doubles
+inline bool overlapping_intervals(const double* intervals, std::size_t num, double lower, double upper) {
+    std::size_t i = 0;
+    const double inf = std::numeric_limits<double>::infinity();
+#if defined(__AVX512F__)
+    const __m512d uppers = _mm512_set_pd(inf, upper, inf, upper, inf, upper, inf, upper);
+    const __m512d lowers = _mm512_set_pd(lower, -inf, lower, -inf, lower, -inf, lower, -inf);
+    for (; i + 8 <= num; i += 8) {
+        __m512d values = _mm512_loadu_pd(intervals + i);
+        unsigned passed = ~(_mm512_cmp_pd_mask(values, uppers, _CMP_GT_OQ) | _mm512_cmp_pd_mask(lowers, values, _CMP_GT_OQ));
+        if (passed & (passed >> 1) & 0x55) return true;
+    }
+#elif defined(__AVX2__)
+    const __m256d uppers = _mm256_set_pd(inf, upper, inf, upper);
+    const __m256d lowers = _mm256_set_pd(lower, -inf, lower, -inf);
+    for (; i + 4 <= num; i += 4) {
+        __m256d values = _mm256_loadu_pd(intervals + i);
+        __m256d failed = _mm256_or_pd(_mm256_cmp_pd(values, uppers, _CMP_GT_OQ), _mm256_cmp_pd(lowers, values, _CMP_GT_OQ));
+        unsigned passed = ~_mm256_movemask_pd(failed);
+        if (passed & (passed >> 1) & 0x5) return true;
+    }
+#elif defined(__SSE2__)
+    const __m128d uppers = _mm_set_pd(inf, upper);
+    const __m128d lowers = _mm_set_pd(lower, -inf);
+    for (; i + 2 <= num; i += 2) {
+        __m128d values = _mm_loadu_pd(intervals + i);
+        __m128d failed = _mm_or_pd(_mm_cmpgt_pd(values, uppers), _mm_cmpgt_pd(lowers, values));
+        if (_mm_movemask_pd(failed) == 0) return true;
+    }
+#endif
+    for (; i + 2 <= num; i += 2) {
+        if (intervals[i] <= upper && intervals[i + 1] >= lower) return true;
+    }
+    return false;
+}
+
+
+#endif
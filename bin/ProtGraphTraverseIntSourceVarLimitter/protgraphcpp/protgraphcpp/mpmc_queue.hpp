@@ -0,0 +1,148 @@
+#ifndef MPMCQUEUE_H
+#define MPMCQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+
+#define QUEUE_SPIN_LIMIT 1024  // Default number of failed attempts, before a waiting thread parks
+
+
+// Bounded lock-free multi-producer multi-consumer queue: a ring buffer of Capacity slots, each with a sequence number
+// telling whether it is free for the producer or filled for the consumer of its round (after D. Vyukov). Items are
+// moved in and out. A producer of a full (consumer of an empty) queue spins up to spin_limit attempts and then parks
+// on the number of pops (pushes) until it changes. Parked threads are only notified, if there are any.
+template<class T, std::size_t Capacity>
+class MPMCQueue {
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "The capacity of a MPMCQueue has to be a power of two");
+
+    public:
+        explicit MPMCQueue(std::size_t spin_limit = QUEUE_SPIN_LIMIT) : spin_limit(spin_limit), slots(Capacity) {
+            for (std::size_t i = 0; i < Capacity; i++) {
+                this->slots[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        };
+        MPMCQueue(const MPMCQueue&) = delete;
+        MPMCQueue& operator=(const MPMCQueue&) = delete;
+
+        // Non-blocking, false if the queue is full (the item is then left untouched)
+        template<class U>
+        bool try_push(U&& item) {
+            std::size_t pos = this->enqueue_pos.load(std::memory_order_relaxed);
+            Slot* slot;
+            while (true) {
+                slot = &this->slots[pos & (Capacity - 1)];
+                std::intptr_t diff = (std::intptr_t) slot->sequence.load(std::memory_order_acquire) - (std::intptr_t) pos;
+                if (diff == 0 && this->enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {break;}
+                if (diff < 0) {return false;}  // Not yet consumed in the last round
+                if (diff != 0) { pos = this->enqueue_pos.load(std::memory_order_relaxed); }  // Taken by another producer
+            }
+            slot->item = std::forward<U>(item);
+            slot->sequence.store(pos + 1, std::memory_order_release);
+            return true;
+        };
+
+        // Non-blocking, false if the queue is empty
+        bool try_pop(T& item) {
+            std::size_t pos = this->dequeue_pos.load(std::memory_order_relaxed);
+            Slot* slot;
+            while (true) {
+                slot = &this->slots[pos & (Capacity - 1)];
+                std::intptr_t diff = (std::intptr_t) slot->sequence.load(std::memory_order_acquire) - (std::intptr_t) (pos + 1);
+                if (diff == 0 && this->dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {break;}
+                if (diff < 0) {return false;}  // Not yet produced in this round
+                if (diff != 0) { pos = this->dequeue_pos.load(std::memory_order_relaxed); }  // Taken by another consumer
+            }
+            item = std::move(slot->item);
+            slot->sequence.store(pos + Capacity, std::memory_order_release);
+            return true;
+        };
+
+        // Blocks while the queue is full
+        template<class U>
+        void push_back(U&& item) {
+            this->wait_for(this->pops, this->parked_producers, [&] { return this->try_push(std::forward<U>(item)); });
+            this->signal(this->pushes, this->parked_consumers);
+        };
+
+        // Pushes all items (moved) and notifies the consumers once (or before it has to wait for space)
+        void push_batch(std::vector<T>& items) {
+            for (T& item : items) {
+                if (this->try_push(std::move(item))) {continue;}
+                this->signal(this->pushes, this->parked_consumers);
+                this->wait_for(this->pops, this->parked_producers, [&] { return this->try_push(std::move(item)); });
+            }
+            this->signal(this->pushes, this->parked_consumers);
+        };
+
+        // Blocks while the queue is empty
+        T pop_front() {
+            T item;
+            this->wait_for(this->pushes, this->parked_consumers, [&] { return this->try_pop(item); });
+            this->signal(this->pops, this->parked_producers);
+            return item;
+        };
+
+        // Blocks while the queue is empty, then takes up to max_items (appended to items). Returns their number
+        std::size_t pop_batch(std::vector<T>& items, std::size_t max_items) {
+            items.emplace_back();
+            this->wait_for(this->pushes, this->parked_consumers, [&] { return this->try_pop(items.back()); });
+            std::size_t num = 1;
+            for (; num < max_items; num++) {
+                items.emplace_back();
+                if (!this->try_pop(items.back())) {
+                    items.pop_back();
+                    break;
+                }
+            }
+            this->signal(this->pops, this->parked_producers);
+            return num;
+        };
+
+    private:
+        struct Slot {
+            std::atomic<std::size_t> sequence;
+            T item;
+        };
+
+        // Retries attempt, until it succeeds: spinning first, then parked until the counter of the other side changes
+        template<class Attempt>
+        void wait_for(std::atomic<std::uint32_t>& counter, std::atomic<std::uint32_t>& parked, Attempt&& attempt) {
+            for (std::size_t spins = 0; spins < this->spin_limit; spins++) {
+                if (attempt()) {return;}
+            }
+            while (true) {
+                parked.fetch_add(1);
+                std::uint32_t seen = counter.load();
+                if (attempt()) {
+                    parked.fetch_sub(1);
+                    return;
+                }
+                counter.wait(seen);
+                parked.fetch_sub(1);
+                if (attempt()) {return;}
+            }
+        };
+
+        void signal(std::atomic<std::uint32_t>& counter, std::atomic<std::uint32_t>& parked) {
+            counter.fetch_add(1);
+            if (parked.load() != 0) {
+                counter.notify_all();
+            }
+        };
+
+        std::size_t spin_limit;  // 0 --> park right away
+        std::vector<Slot> slots;
+        alignas(64) std::atomic<std::size_t> enqueue_pos{0};
+        alignas(64) std::atomic<std::size_t> dequeue_pos{0};
+        alignas(64) std::atomic<std::uint32_t> pushes{0};  // Counters (wrapping) to park on
+        std::atomic<std::uint32_t> pops{0};
+        alignas(64) std::atomic<std::uint32_t> parked_consumers{0};
+        std::atomic<std::uint32_t> parked_producers{0};
+};
+
+
+#endif
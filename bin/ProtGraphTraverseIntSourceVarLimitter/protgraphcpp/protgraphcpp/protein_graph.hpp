@@ -1,54 +1,103 @@
 #ifndef PROTEINGRAPH_H
 #define PROTEINGRAPH_H
 #include <fstream>
+#include <istream>
 
 #include <cstdint>
 #include <string>
+#include <utility>
+#include <tuple>
 #include <vector>
 #include <deque>
+#include <memory>
 #include <unordered_map>
 
+#include "column_arena.hpp"
+#include "string_pool.hpp"
+
+
+// Optional columns of a graph (NO, ED, MW, VC, PDB and the first accession are always loaded).
+// The loaders skip the columns which were not requested, their pointers stay null.
+#define COLUMN_ACCESSIONS 0x01  // All further accessions (of the isoforms)
+#define COLUMN_SEQUENCES 0x02  // SQ
+#define COLUMN_POSITIONS 0x04  // PO, IS and IP
+#define COLUMN_CLEAVED 0x08  // CL
+#define COLUMN_QUALIFIERS 0x10  // QU
+#define COLUMNS_ALL 0x1F  // Needed to generate the FASTA
+#define COLUMNS_TRAVERSAL 0x00  // Needed to traverse only
+
+
+// A graph owns its columns (carved from its arena), a mapped graph shares the ownership of the mapping instead.
+// Hence it can only be moved, the columns are freed with the graph.
 class ProteinGraph {
     public:
-        ProteinGraph(std::uint32_t num_acc, std::ifstream &input, std::unordered_map<std::string, std::vector<uint8_t>> max_vars);
+        ProteinGraph() = default;
+        ProteinGraph(std::uint32_t num_acc, std::istream &input, std::shared_ptr<StringPool> strings, const std::unordered_map<std::string, std::vector<uint8_t>>& max_vars, std::uint32_t columns = COLUMNS_ALL);
+        ProteinGraph(const char* record, std::shared_ptr<const char> mapping, std::shared_ptr<StringPool> strings, const std::unordered_map<std::string, std::vector<uint8_t>>& max_vars, std::uint32_t columns = COLUMNS_ALL);  // From a mapped record (see mapped_graph_format.hpp)
+        ProteinGraph(const ProteinGraph&) = delete;
+        ProteinGraph& operator=(const ProteinGraph&) = delete;
+        ProteinGraph(ProteinGraph&&) = default;
+        ProteinGraph& operator=(ProteinGraph&&) = default;
         ~ProteinGraph() = default;
 
-        uint32_t N;
-        uint32_t E;
-        uint32_t PDB;
+        uint32_t N = 0;
+        uint32_t E = 0;
+        uint32_t PDB = 0;
         std::vector<std::string> accessions;
-        std::uint32_t* nodes; // Node
-        std::uint8_t* iso_index;
-        std::int64_t* mono_weight;
+        std::uint32_t* nodes = nullptr; // Node
+        std::uint8_t* iso_index = nullptr;
+        std::int64_t* mono_weight = nullptr;
 
-        std::uint32_t* edges; // Edge
-        std::vector<bool> cleaved; // Edge Attrs  <-- as bool vector TODO DL
+        std::uint32_t* edges = nullptr; // Edge
+        std::uint8_t* cleaved = nullptr; // Edge Attrs
 
 
         // Other specific information
-        std::uint8_t* variant_count;  // On Edges  <-- maybe parsing?
-        std::int64_t* pdbs;  // On Nodes
+        std::uint8_t* variant_count = nullptr;  // On Edges  <-- maybe parsing?
+        std::uint32_t num_variant_edges = 0;  // Edges with variants (counted when loading, see estimated_cost)
+        bool edges_sorted = false;  // Outgoing edges sorted by the mass of their targets (see sort_edges)
+        std::int64_t* pdbs = nullptr;  // On Nodes (lower and upper bound of the sorted and merged intervals of each node)
+        std::uint32_t* pdb_offsets = nullptr;  // On Nodes (N+1), the intervals of node i are pdbs[pdb_offsets[i]] up to pdbs[pdb_offsets[i+1]]
         
-        std::uint16_t* position;  // On Nodes TODO DL
-        std::uint16_t* iso_position;  // On Nodes
-        char* sequence_str; // Node/Edge Attrs (compacted, this could probably be also made seperately)
-        std::uint32_t* sequence_str_index; // Node/Edge Attrs (compacted, this could probably be also made seperately)
-
-        char* qualifiers_str; // Node/Edge Attrs (compacted, this could probably be also made seperately)
-        std::uint32_t* qualifiers_str_index; // Node/Edge Attrs (compacted, this could probably be also made seperately)
-        // char* qualifiers_str[]; 
+        std::uint16_t* position = nullptr;  // On Nodes TODO DL
+        std::uint16_t* iso_position = nullptr;  // On Nodes
+        std::uint32_t* sequence_str_index = nullptr; // Node Attrs (ids in the string pool)
+        std::uint32_t* qualifiers_str_index = nullptr; // Edge Attrs (ids in the string pool)
+        std::shared_ptr<StringPool> strings;  // Shared by all graphs of a graph set
+        const char* sequence(std::uint32_t node) const { return this->strings->get(this->sequence_str_index[node]); }
+        const char* qualifiers(std::uint32_t edge) const { return this->strings->get(this->qualifiers_str_index[edge]); }
 
         // Information for how high we can go with the variants
-        std::uint8_t* max_vars_bins;
-        uint32_t num_bins;
+        std::vector<std::uint8_t> max_vars_bins;
+        uint32_t num_bins = 0;
+        void set_max_vars(const std::unordered_map<std::string, std::vector<uint8_t>>& max_vars);
+        void prune(std::int64_t max_mass);  // Removes the nodes and edges of no path up to max_mass
 
         // TODO what methods to include?
         bool overlapping_interval(uint32_t node_num, int64_t lower, int64_t upper);
+        void accepted_ranges(uint32_t node_num, const std::vector<std::int64_t>& tv_vals, std::int64_t weight, std::int64_t lower, std::int64_t upper, std::vector<std::pair<std::size_t, std::size_t>>& ranges);
+        bool overlapping_windows(uint32_t node_num, const std::vector<std::tuple<std::int64_t, std::int64_t>>& windows, std::int64_t achieved);
         std::string tvs_traverse_naive(int64_t lower, int64_t upper);
         std::string tvs_traverse_varcount_naive(int64_t lower, int64_t upper, uint8_t max_vars);
+        std::string tvs_traverse_merged(int64_t lower, int64_t upper, uint8_t max_vars);
+        std::vector<std::string> tvs_traverse_batch(const std::vector<std::tuple<int64_t, int64_t>>& windows, const std::vector<uint8_t>& max_vars);
+
+        // Parts of the traversals above (split by the start edges), which can be run by several threads
+        std::vector<std::vector<uint32_t>> naive_paths(int64_t lower, int64_t upper, std::uint32_t part, std::uint32_t parts);
+        std::vector<std::vector<uint32_t>> varcount_paths(int64_t lower, int64_t upper, uint8_t max_vars, std::uint32_t part, std::uint32_t parts);
+        std::vector<std::vector<std::vector<uint32_t>>> batch_paths(const std::vector<std::tuple<int64_t, int64_t>>& windows, const std::vector<uint8_t>& max_vars, std::uint32_t part, std::uint32_t parts);
+        static std::vector<std::vector<uint32_t>> merge_parts(std::vector<std::vector<std::vector<uint32_t>>>& part_paths);
+        std::uint32_t start_edges() const { return (this->N == 0) ? 0 : this->nodes[0]; }
 
+        double estimated_cost() const;  // Of a traversal, to dispatch the most expensive graphs first
         std::uint32_t get_edge_index(uint32_t source_node, uint32_t target_node);
         std::string convert_paths_to_fasta(std::vector<std::vector<uint32_t>> paths);
+
+    private:
+        void sort_edges();
+        ColumnArena arena;  // All columns (except PDB)
+        ColumnArena pdb_arena;  // PDB (its size is only known after merging the intervals)
+        std::shared_ptr<const char> mapping;  // Only for mapped graphs
 };
 
 
@@ -0,0 +1,64 @@
+#ifndef STRINGPOOL_H
+#define STRINGPOOL_H
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+
+#define STRING_POOL_SHARDS 64  // Independent hash maps, so that concurrent loaders rarely share a lock
+#define STRING_POOL_CHUNK_SIZE (1 << 20)  // Storage of the strings (per shard)
+#define STRING_POOL_FIRST_SEGMENT_BITS 10  // The id table grows in segments of 2^10, 2^11, ... entries
+#define STRING_POOL_MAX_SEGMENTS (33 - STRING_POOL_FIRST_SEGMENT_BITS)
+
+
+// Immutable strings (sequences and qualifiers) shared by all graphs of a graph set. Each distinct
+// string is stored once and referenced by its 32-bit id. Interning is thread-safe, looking up an
+// id is lock-free (the id has to be received from intern/adopt, e.g. via the graph).
+class StringPool {
+    public:
+        StringPool() = default;
+        StringPool(const StringPool&) = delete;
+        StringPool& operator=(const StringPool&) = delete;
+        ~StringPool();
+
+        // Id of the string, it is copied into the pool if it is new
+        std::uint32_t intern(std::string_view str);
+        // Appends a string which is owned elsewhere (e.g. by a mapping), without deduplication
+        std::uint32_t adopt(const char* str);
+        // Keeps the owner of adopted strings alive as long as the pool (e.g. the mapping, also once no graph points into it)
+        void keep(std::shared_ptr<const void> owner) { this->owners.push_back(std::move(owner)); }
+
+        const char* get(std::uint32_t id) const {
+            std::uint64_t pos = (std::uint64_t) id + (1 << STRING_POOL_FIRST_SEGMENT_BITS);
+            int segment = std::bit_width(pos) - 1 - STRING_POOL_FIRST_SEGMENT_BITS;
+            return this->segments[segment].load(std::memory_order_acquire)[pos - ((std::uint64_t) 1 << (segment + STRING_POOL_FIRST_SEGMENT_BITS))];
+        }
+        std::uint32_t size() const { return this->next_id.load(); }
+
+    private:
+        struct Shard {
+            std::mutex mutex;
+            std::unordered_map<std::string_view, std::uint32_t> ids;
+            std::vector<std::unique_ptr<char[]>> chunks;
+            std::size_t chunk_used = STRING_POOL_CHUNK_SIZE;  // Of the last chunk
+        };
+
+        const char* store(Shard& shard, std::string_view str);
+        void publish(std::uint32_t id, const char* str);
+
+        Shard shards[STRING_POOL_SHARDS];
+        std::atomic<std::uint32_t> next_id{0};
+        std::atomic<const char**> segments[STRING_POOL_MAX_SEGMENTS] = {};
+        std::vector<std::shared_ptr<const void>> owners;  // Of adopted strings
+};
+
+
+#endif
@@ -0,0 +1,115 @@
+#!/bin/bash
+
+# Regression check of all four implementations: traverses the fixture graph sets (in BPCSR, CPCSR and MPCSR) and
+# diffs the results against the output of the original implementations (in expected, computed from the BPCSR-files
+# on one thread), also with each optional flag. The graph sets are:
+#   graphs: six tryptic graphs, the queries in graphs_queries_pruned.csv are light enough that every graph is
+#           pruned on loading
+#   dense:  two graphs with many variants, whose nodes are reached by more than FRONTIER_SCAN_LIMIT (64) partial
+#           paths (so that they are sorted and accepted in ranges)
+#   inverted: both sets, with the first interval of every fourth node inverted (lower bound above upper bound,
+#             so that these nodes are not merged but scanned as given)
+#
+# Usage: run_regression.sh [<build-dir> [<threads>]]
+#   build-dir: name of the build directory of each implementation (default: build, see compile_and_setup_depencies.sh)
+#   threads:   number of threads to run with (default: 1 and 4)
+#
+# The MPCSR-files were written by protgraphconvertint/protgraphconvertfloat (little endian). After a change of
+# MPCSR_VERSION they are regenerated with: protgraphconvert<int|float> <set>.bpcsr <set>_<int|float>.mpcsr
+
+FIXTURE=$(cd "$(dirname "$0")" && pwd)
+BIN=$(dirname "$FIXTURE")
+BUILD=${1:-build}
+THREADS=${2:-"1 4"}
+
+# Run on a copy, since the loaders write index files next to the graphs
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+cp "$FIXTURE"/*.bpcsr "$FIXTURE"/*.cpcsr "$FIXTURE"/*.mpcsr "$FIXTURE"/*.csv "$WORK"
+
+# Query files of each graph set (<set>_limits.csv holds its variant limits)
+declare -A QUERIES=([graphs]="graphs_queries graphs_queries_pruned" [dense]="dense_queries" [inverted]="inverted_queries")
+
+# Optional flags, which must not change the output (each run on its own)
+VARLIMITTER_FLAGS=("" "--merge" "--batch=3" "--batch=16" "--in-flight=1" "--in-flight=8"
+                   "--graph-threads=1" "--graph-threads=2")
+DRYRUN_FLAGS=("" "--merge" "--in-flight=1" "--in-flight=8")
+# Only for BPCSR-files (a resident limit of 0.01 MB evicts the graphs again and again, chunks of 0.01 MB hold few graphs)
+VARLIMITTER_BPCSR_FLAGS=("--lazy" "--lazy=0.01" "--stream=1" "--stream=0.01")
+
+# Accessions of --include/--exclude, their expected output are the entries of these graphs (isoforms in the headers
+# belong to the graph of their canonical accession) respectively of all others
+printf "P00004\nQ00001\n" > "$WORK/accessions.txt"
+filter_fasta() {  # <include|exclude> <fasta>
+    awk -v deny=$([ "$1" == "exclude" ] && echo 1 || echo 0) 'NR == FNR {listed[$0]; next}
+        /^>/ {split($0, header, "|"); acc = header[3]; sub(/\(.*/, "", acc); sub(/-[0-9]+$/, "", acc); keep = ((acc in listed) != deny)}
+        keep' "$WORK/accessions.txt" "$2"
+}
+filter_csv() {  # <include|exclude> <csv>
+    awk -F, -v deny=$([ "$1" == "exclude" ] && echo 1 || echo 0) 'NR == FNR {listed[$0]; next}
+        (($1 in listed) != deny)' "$WORK/accessions.txt" "$2"
+}
+
+failed=0
+check() {  # <name> <expected> <actual>
+    if cmp -s "$2" "$3"; then
+        echo "OK    $1"
+    else
+        echo "DIFF  $1"
+        failed=1
+    fi
+}
+
+for v in int float; do
+    V=${v^}
+    VARLIMITTER=$BIN/ProtGraphTraverse${V}SourceVarLimitter/$BUILD/protgraphtraverse${v}varlimitter
+    DRYRUN=$BIN/ProtGraphTraverse${V}SourceDryRun/$BUILD/protgraphtraverse${v}dryrun
+    for exe in "$VARLIMITTER" "$DRYRUN"; do
+        if [ ! -x "$exe" ]; then
+            echo "Missing binary: $exe"
+            exit 1
+        fi
+    done
+
+    for set in graphs dense inverted; do
+        for graphs in $set.bpcsr $set.cpcsr ${set}_$v.mpcsr; do
+            for t in $THREADS; do
+                for queries in ${QUERIES[$set]}; do
+                    flags=("${VARLIMITTER_FLAGS[@]}")
+                    if [ "$graphs" == "$set.bpcsr" ]; then
+                        flags+=("${VARLIMITTER_BPCSR_FLAGS[@]}")
+                    fi
+                    for flag in "${flags[@]}"; do
+                        rm -f "$WORK/out.fasta"
+                        "$VARLIMITTER" "$WORK/$graphs" "$WORK/$queries.csv" $t "$WORK/out.fasta" "$WORK/${set}_limits.csv" $flag > /dev/null 2>&1
+                        check "$v varlimitter $graphs $queries.csv (threads: $t) $flag" "$FIXTURE/expected/${v}_$queries.fasta" "$WORK/out.fasta"
+                    done
+
+                    # The runtime (fifth column) differs and the rows are written in the order they finish
+                    for flag in "${DRYRUN_FLAGS[@]}"; do
+                        rm -f "$WORK/out.csv"
+                        "$DRYRUN" "$WORK/$graphs" "$WORK/$queries.csv" $t "$WORK/out.csv" 2 5 $flag > /dev/null 2>&1
+                        cut -d, -f1-4,6 "$WORK/out.csv" | sort > "$WORK/dryrun.csv"
+                        check "$v dryrun $graphs $queries.csv (threads: $t) $flag" "$FIXTURE/expected/${v}_${queries}_dryrun.csv" "$WORK/dryrun.csv"
+                    done
+
+                    for filter in include exclude; do
+                        flag="--$filter=$WORK/accessions.txt"
+                        rm -f "$WORK/out.fasta"
+                        "$VARLIMITTER" "$WORK/$graphs" "$WORK/$queries.csv" $t "$WORK/out.fasta" "$WORK/${set}_limits.csv" $flag > /dev/null 2>&1
+                        filter_fasta $filter "$FIXTURE/expected/${v}_$queries.fasta" > "$WORK/expected.fasta"
+                        check "$v varlimitter $graphs $queries.csv (threads: $t) --$filter" "$WORK/expected.fasta" "$WORK/out.fasta"
+
+                        rm -f "$WORK/out.csv"
+                        "$DRYRUN" "$WORK/$graphs" "$WORK/$queries.csv" $t "$WORK/out.csv" 2 5 $flag > /dev/null 2>&1
+                        cut -d, -f1-4,6 "$WORK/out.csv" | sort > "$WORK/dryrun.csv"
+                        filter_csv $filter "$FIXTURE/expected/${v}_${queries}_dryrun.csv" > "$WORK/expected.csv"
+                        check "$v dryrun $graphs $queries.csv (threads: $t) --$filter" "$WORK/expected.csv" "$WORK/dryrun.csv"
+                    done
+                done
+            done
+        done
+    done
+done
+
+exit $failed